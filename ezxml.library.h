@@ -29,8 +29,8 @@
 #define TO_STRING(x) #x
 #define MACRO_TO_STRING(x) TO_STRING(x)
 
-#define	VERSION  8
-#define	REVISION 6
+#define	VERSION  9
+#define	REVISION 0
 #define	DATE     __AMIGADATE__
 #define	VERS     "ezxml.library " MACRO_TO_STRING(VERSION)"."MACRO_TO_STRING(REVISION)
 #define	VSTRING  VERS " " __AMIGADATE__" 2011-2012 by Filip \"widelec\" Maryjaski, written by Aaron Voisine\r\n"
@@ -57,6 +57,39 @@ void ezxml_set_txt_d(void);
 void ezxml_set_attr_d(void);
 void ezxml_move(void);
 void ezxml_remove(void);
+void ezxml_parser_new(void);
+void ezxml_parse_chunk(void);
+void ezxml_parse_finish(void);
+void ezxml_reader_open(void);
+void ezxml_reader_next(void);
+void ezxml_reader_error(void);
+void ezxml_reader_close(void);
+void ezxml_parse_str_flags(void);
+void ezxml_sym(void);
+void ezxml_child_sym(void);
+void ezxml_attr_sym(void);
+void ezxml_count(void);
+void ezxml_query_compile(void);
+void ezxml_query_exec(void);
+void ezxml_query_free(void);
+void ezxml_index_create(void);
+void ezxml_index_get(void);
+void ezxml_index_range(void);
+void ezxml_index_prefix(void);
+void ezxml_index_free(void);
+void ezxml_iter_init(void);
+void ezxml_iter_next(void);
+void ezxml_iter_skip_subtree(void);
+void ezxml_foreach(void);
+void ezxml_attrs_bind(void);
+void ezxml_children_bind(void);
+void ezxml_src_pos(void);
+void ezxml_line_col(void);
+void ezxml_query_exec_parallel(void);
+void ezxml_parse_fd_overlap(void);
+void ezxml_toxml_gz(void);
+void ezxml_toxml_fd(void);
+void ezxml_toxml_cb(void);
 
 ULONG LibFuncTable[] =
 {
@@ -96,6 +129,39 @@ ULONG LibFuncTable[] =
 	(ULONG) &ezxml_set_attr_d,
 	(ULONG) &ezxml_move,
 	(ULONG) &ezxml_remove,
+	(ULONG) &ezxml_parser_new,
+	(ULONG) &ezxml_parse_chunk,
+	(ULONG) &ezxml_parse_finish,
+	(ULONG) &ezxml_reader_open,
+	(ULONG) &ezxml_reader_next,
+	(ULONG) &ezxml_reader_error,
+	(ULONG) &ezxml_reader_close,
+	(ULONG) &ezxml_parse_str_flags,
+	(ULONG) &ezxml_sym,
+	(ULONG) &ezxml_child_sym,
+	(ULONG) &ezxml_attr_sym,
+	(ULONG) &ezxml_count,
+	(ULONG) &ezxml_query_compile,
+	(ULONG) &ezxml_query_exec,
+	(ULONG) &ezxml_query_free,
+	(ULONG) &ezxml_index_create,
+	(ULONG) &ezxml_index_get,
+	(ULONG) &ezxml_index_range,
+	(ULONG) &ezxml_index_prefix,
+	(ULONG) &ezxml_index_free,
+	(ULONG) &ezxml_iter_init,
+	(ULONG) &ezxml_iter_next,
+	(ULONG) &ezxml_iter_skip_subtree,
+	(ULONG) &ezxml_foreach,
+	(ULONG) &ezxml_attrs_bind,
+	(ULONG) &ezxml_children_bind,
+	(ULONG) &ezxml_src_pos,
+	(ULONG) &ezxml_line_col,
+	(ULONG) &ezxml_query_exec_parallel,
+	(ULONG) &ezxml_parse_fd_overlap,
+	(ULONG) &ezxml_toxml_gz,
+	(ULONG) &ezxml_toxml_fd,
+	(ULONG) &ezxml_toxml_cb,
 	0xffffffff,
 	FUNCARRAY_END
 };
@@ -38,9 +38,9 @@
 *
 *   - ezXML is not a validating parser
 *
-*   - Loads the entire XML document into memory at once and does not support
-*     incremental parsing. Large XML files can still be handled though through
-*     ezxml_parse_file() and ezxml_parse_fd().
+*   - Keeps the entire XML document in memory. Documents arriving in parts can
+*     be parsed as they come with ezxml_parse_chunk(), the tree is available
+*     only after ezxml_parse_finish() though.
 *
 *   - Does not currently recognize all possible well-formedness errors. It should
 *     correctly handle all well-formed XML documents and will either ignore or halt
@@ -125,66 +125,453 @@
 #include <stdlib.h>
 #include <proto/dos.h>
 #include <libraries/dos.h>
+#include <dos/dostags.h>
 #include "os-include/libraries/ezxml.h"
 #include "libdata.h"
 #include "debug.h"
 
+#ifdef __ALTIVEC__
+#include <altivec.h>
+#endif /* __ALTIVEC__ */
+
+#ifndef EZXML_NOZLIB
+#include <zlib.h>
+#endif /* EZXML_NOZLIB */
+
 #define EZXML_BUFSIZE 1024       // size of internal memory buffers
+#define EZXML_READSIZE 0x10000   // first read of a stream, the buffer doubles from there
+#define EZXML_PIPESIZE 0x40000   // size of the blocks read ahead by ezxml_parse_fd_overlap()
+#define EZXML_ZWINDOW 0x10000    // size of the buffers of compressed input and output
+#define EZXML_OUTSIZE 0x10000    // size of the buffer of ezxml_toxml_fd() and ezxml_toxml_cb()
 #define EZXML_NAMEM   0x80       // name is malloced
 #define EZXML_TXTM    0x40       // txt is malloced
 #define EZXML_DUP     0x20       // attribute name and value are strduped
+#define EZXML_TXTS    0x10       // txt is the first of a list of text segments
+#define EZXML_TXTD    0x08       // txt or attribute value is decoded on first access
+#define EZXML_TXTN    0x04       // attribute value to decode is not cdata
 #define EZXML_WS      "\t\r\n "  // whitespace
 #define EZXML_ERRL    128        // maximum error string length
+#define EZXML_BLKSIZE 0x8000     // minimum size of input blocks of the push parser
+#define EZXML_NAMES   16         // initial size of the name lists of a reader
+#define EZXML_CHUNK   0x1000     // size of the first chunk of a document arena
+#define EZXML_CHUNKMAX 0x100000  // chunk sizes double up to this size
+#define EZXML_NAMEIDX 16         // distinct subtag names a tag needs for htab
+#define EZXML_VECMIN  8          // smallest index ezxml_idx() builds a vec for
+#define EZXML_QSET    32         // initial size of the node sets of a query
+#define EZXML_PMIN    64         // tags a step starts from to be worth parallel evaluation
+#define EZXML_PSPLIT  8          // chunks of work per process of a parallel query
+#define EZXML_PDEPTH  8          // levels a parallel '//' step splits subtrees down to
+#define EZXML_NOPOS   (~0UL)     // pos of a tag not read from the input
+#define EZXML_ALIGN(n) (((n) + 7) & ~7UL) // alignment of arena allocations
 #define EZXML_NOMMAP
 
+#define EZXML_C_WS    0x01       // one of EZXML_WS
+#define EZXML_C_SP    0x02       // isspace()
+#define EZXML_C_NUL   0x04       // null terminator
+#define EZXML_C_SL    0x08       // '/'
+#define EZXML_C_GT    0x10       // '>'
+#define EZXML_C_EQ    0x20       // '='
+#define EZXML_C_DEC   0x40       // character content has to go through ezxml_decode()
+#define EZXML_C_ADEC  0x80       // attribute value has to go through ezxml_decode()
+#define EZXML_CC(c)   ezxml_cc[(UBYTE)(c)]
+
+#define EZXML_Q_CHILD 'c'        // step selects subtags, name is NULL for '*'
+#define EZXML_Q_SELF  's'        // step is '.'
+#define EZXML_Q_UP    'p'        // step is '..'
+#define EZXML_Q_POS   'n'        // predicate [n], position among the candidates
+#define EZXML_Q_LAST  'l'        // predicate [last()]
+#define EZXML_Q_ATTR  '@'        // predicate [@name] or [@name op literal]
+#define EZXML_Q_SUB   't'        // predicate [name] or [name op literal]
+#define EZXML_Q_TXT   '.'        // predicate [text() op literal] or [. op literal]
+#define EZXML_Q_EQ    1          // '='
+#define EZXML_Q_NE    2          // '!='
+#define EZXML_Q_LT    3          // '<'
+#define EZXML_Q_LE    4          // '<='
+#define EZXML_Q_GT    5          // '>'
+#define EZXML_Q_GE    6          // '>='
+
 #define malloc(x) AllocVec(x, MEMF_PUBLIC | MEMF_CLEAR)
 #define free(x) FreeVec(x)
 #define memcpy(x, y, z) MemCopy(x, y, z, MyLibBase)
 #define realloc(x, y) ReAlloc(x, y, MyLibBase)
 #define strdup(x) StrNew(x, MyLibBase)
 
+struct ezxml_block        // input of the push parser, kept as long as the tree
+{
+	struct ezxml_block *next;
+	STRPTR data;
+	ULONG size;            // size of data, not counting the null terminator
+};
+
+struct ezxml_chunk        // memory of a document arena
+{
+	struct ezxml_chunk *next; // chunk filled before this one
+	ULONG size;            // bytes of memory following the header
+	ULONG used;            // bytes handed out already
+	ULONG pad;             // keeps the memory aligned
+};
+#define EZXML_MEM(c) ((UBYTE *)((c) + 1)) // memory of chunk c
+
+struct ezxml_seg          // part of the character content of a tag
+{
+	struct ezxml_seg *next;
+	STRPTR s;              // null terminated text
+	ULONG len;             // length of s
+};
+
 typedef struct ezxml_root *ezxml_root_t;
+struct ezxml_node         // tag allocated by the library
+{
+	struct ezxml xml;      // is a super-struct built on top of ezxml struct
+	ezxml_root_t doc;      // document whose arena holds the tag
+	ULONG amax;            // attributes attr has room for, 0 if it is full
+	struct ezxml_seg *seg; // last text segment, pointing to the first, or NULL
+	ULONG len;             // length of txt, including all segments
+	ezxml_t last;          // last subtag in the ordered list
+	ezxml_t tail;          // last tag of the next list, first tag of a name only
+	ezxml_t stail;         // last tag of the sibling list of the subtags
+	ezxml_t *htab;         // first subtag of each name by name hash, or NULL
+	ULONG hmask;           // number of buckets of htab minus one
+	ULONG names;           // number of distinct subtag names
+	ezxml_t hnext;         // next tag in the same htab bucket of the parent
+	ezxml_t *vec;          // tags of the next list by index, first tag only, or NULL
+	ULONG count;           // number of tags in the next list, first tag only
+	ULONG vmax;            // number of entries vec has room for
+	ULONG pos;             // offset of the start tag in the input, or EZXML_NOPOS
+	ULONG slen;            // length in the input up to the end tag, 0 until closed
+};
+#define EZXML_NODE(x) ((struct ezxml_node *)(x))
+#define EZXML_DOC(x) (EZXML_NODE(x)->doc)
+
+struct ezxml_ent          // declared entity
+{
+	struct ezxml_ent *next; // next entity in the same hash bucket
+	STRPTR name;           // name followed by ';'
+	STRPTR value;          // replacement text
+	ULONG len;             // length of name, including the ';'
+	ULONG vlen;            // length of replacement text
+};
+
+struct ezxml_ents         // hash table of declared entities, all zero when empty
+{
+	struct ezxml_ent **tab; // buckets, a power of two of them
+	ULONG mask;            // number of buckets minus one
+	ULONG count;           // number of entities
+	ULONG max;             // length of the longest name, including the ';'
+};
+
+struct ezxml_sym          // interned tag or attribute name
+{
+	struct ezxml_sym *next; // next name in the same hash bucket
+	STRPTR name;           // the one copy of the name all tags share
+	ULONG hash;            // ezxml_hash() of name
+};
+
+struct ezxml_syms         // hash table of interned names, all zero when empty
+{
+	struct ezxml_sym **tab; // buckets, a power of two of them
+	ULONG mask;            // number of buckets minus one
+	ULONG count;           // number of names
+};
+
+struct ezxml_def          // default attribute declared in the DTD
+{
+	struct ezxml_def *next; // next default in the same hash bucket
+	STRPTR tag;            // tag name
+	STRPTR name;           // attribute name, NULL for the entry of the tag itself
+	STRPTR value;          // default value, NULL if there is none
+	STRPTR mode;           // "*" for non-cdata, " " for cdata attributes
+	ULONG i;               // index of the list of the tag in root->attr
+	ULONG hash;            // ezxml_def_hash() of tag and name
+};
+
+struct ezxml_defs         // hash table of default attributes, all zero when empty
+{
+	struct ezxml_def **tab; // buckets, a power of two of them
+	ULONG mask;            // number of buckets minus one
+	ULONG count;           // number of entries
+};
+
 struct ezxml_root         // additional data for the root tag
 {
 	struct ezxml xml;      // is a super-struct built on top of ezxml struct
+	ezxml_root_t doc;      // points to itself, same layout as struct ezxml_node
+	ULONG amax;            // attributes the attr list of the root tag has room for
+	struct ezxml_seg *seg; // last text segment of the root tag
+	ULONG tlen;            // length of the text of the root tag
+	ezxml_t last;          // last subtag of the root tag
+	ezxml_t tail;          // last tag of the next list of the root tag
+	ezxml_t stail;         // last tag of the sibling list of the root tag
+	ezxml_t *htab;         // first subtag of each name of the root tag, or NULL
+	ULONG hmask;           // number of buckets of htab minus one
+	ULONG names;           // number of distinct subtag names of the root tag
+	ezxml_t hnext;         // unused, the root tag is in no htab
+	ezxml_t *vec;          // unused, the root tag is in no next list
+	ULONG count;           // unused
+	ULONG vmax;            // unused
+	ULONG pos;             // offset of the root tag in the input, or EZXML_NOPOS
+	ULONG slen;            // length of the root tag in the input, 0 until closed
 	ezxml_t cur;           // current xml tree insertion point
 	STRPTR m;              // original xml string
 	ULONG len;             // length of allocated memory for mmap, -1 for malloc
 	STRPTR u;              // UTF-8 conversion of string if original was UTF-16
 	STRPTR s;              // start of work area
 	STRPTR e;              // end of work area
-	STRPTR *ent;           // general entities (ampersand sequences)
+	struct ezxml_ents ent; // declared general entities (ampersand sequences)
+	struct ezxml_syms sym; // names of the parsed tags and attributes
+	struct ezxml_defs def; // default attributes by tag and attribute name
 	STRPTR **attr;         // default attributes
 	STRPTR **pi;           // processing instructions
 	SHORT standalone;      // non-zero if <?xml standalone="yes"?>
 	BYTE err[EZXML_ERRL];  // error string
+	struct ezxml_block *blk; // input blocks of the push parser, newest first
+	ULONG off;             // offset of the work area in the input
+	ULONG *nl;             // offsets of the line breaks of the input, ascending
+	ULONG nls;             // number of entries in nl
+	ULONG nlmax;           // number of entries nl has room for
+	ULONG nlto;            // offset in the input up to which nl is complete
+	STRPTR *tmp;           // scratch attribute list of the tag being parsed
+	ULONG tmax;            // number of entries tmp has room for
+	UBYTE *tmpf;           // decoding flags of the values in tmp, lazy parsing only
+	ULONG fmax;            // number of entries tmpf has room for
+	struct ezxml_chunk *mem; // arena holding tags and their data, newest first
+	UBYTE mixed;           // tree has malloced strings or tags of other documents
+	UBYTE lent;            // tags of the document were inserted into another one
+	ULONG mode;            // EZXML_PARSE_* flags the document was parsed with
+	struct LibBase *base;  // library base, for calls that are not given one
+	struct ezxml_index *index; // value indexes of the document
+};
+
+struct ezxml_parser       // state of the push parser between chunks
+{
+	ezxml_root_t root;     // document being built
+	struct ezxml_block *blk; // block holding the unparsed input
+	ULONG pos;             // offset of the unparsed input in blk
+	ULONG len;             // length of the unparsed input
+	ULONG hint;            // bytes of the unparsed input scanned already
+	ULONG cut;             // unparsed input starts with markup, its '<' may be
+	                       // overwritten by the terminator of preceding text
+	UBYTE f;               // class flags seen in the unparsed text
+};
+
+struct ezxml_pipe         // file read ahead by a process while the owner parses
+{
+	BPTR fd;               // file read
+	struct Task *owner;    // task parsing, gets sig as a block is filled
+	LONG sig;
+	struct Task *reader;   // process reading, gets SIGBREAKF_CTRL_F as a block is parsed
+	STRPTR data[2];        // blocks, filled in turn
+	LONG len[2];           // bytes in each block, 0 at the end of the file, -1 on error
+	UBYTE full[2];         // block is filled and not parsed yet
+	UBYTE stop;            // reader is to end early
+	UBYTE done;            // reader has ended
+};                         // len, full, stop and done change under Forbid()
+
+struct ezxml_out          // output of the serializer
+{
+	STRPTR s;              // output not passed on yet
+	ULONG len;             // bytes in s
+	ULONG max;             // size of s
+	BOOL (*flush)(struct ezxml_out *o, ULONG n); // makes room for n more bytes
+	APTR data;             // for flush
+	struct LibBase *base;  // library base s is allocated with
+	BOOL err;              // flush failed, further output is dropped
+};
+
+struct ezxml_sink         // callback of ezxml_toxml_cb()
+{
+	ezxml_write_f fn;
+	APTR data;             // for fn
+};
+
+struct ezxml_reader       // state of a reader between events
+{
+	struct ezxml_event ev; // current event
+	ezxml_root_t root;     // entities and default attributes, error string
+	STRPTR s;              // next byte to read
+	STRPTR *attr;          // attribute list of the current start tag
+	ULONG amax;            // number of entries attr has room for
+	ULONG given;           // entries of attr given in the tag, DTD defaults follow
+	STRPTR *tag;           // names of the open tags
+	ULONG tmax;            // number of entries tag has room for
+	ULONG depth;           // number of open tags
+	BYTE e;                // end char replaced by the null terminator
+	UBYTE lt;              // the '<' at s is overwritten by a null terminator
+	UBYTE end;             // end of the current empty tag is the next event
+	UBYTE done;            // root tag is closed
+};
+
+struct ezxml_pred         // predicate of a query step
+{
+	UBYTE type;            // EZXML_Q_POS, EZXML_Q_LAST, EZXML_Q_ATTR, EZXML_Q_SUB or EZXML_Q_TXT
+	UBYTE op;              // EZXML_Q_EQ to EZXML_Q_GE, 0 for a test of existence
+	UBYTE num;             // literal is a number
+	UBYTE str;             // literal is quoted
+	ULONG pos;             // position for EZXML_Q_POS, counting from 1
+	STRPTR name;           // attribute or subtag name
+	STRPTR lit;            // literal, NULL if it was not quoted
+	DOUBLE val;            // value of the literal if it is a number
+};
+
+struct ezxml_step         // location step of a query
+{
+	STRPTR name;           // tag name, NULL for '*' or if axis is not EZXML_Q_CHILD
+	UBYTE axis;            // EZXML_Q_CHILD, EZXML_Q_SELF or EZXML_Q_UP
+	UBYTE desc;            // step follows '//', applies to all descendants
+	ULONG npred;           // number of predicates
+	struct ezxml_pred *pred; // predicates, applied in order
+};
+
+struct ezxml_query        // compiled query, the path is copied behind the steps
+{
+	ULONG nstep;           // number of steps
+	UBYTE abs;             // path starts with '/', at the document
+	struct ezxml_step *step; // steps, applied in order
+};
+
+struct ezxml_qset         // node set of a query being executed
+{
+	ezxml_t *x;            // tags, NULL stands for the document itself
+	ULONG n;               // number of tags
+	ULONG max;             // number of entries x has room for
+	UBYTE ro;              // filled in parallel, lookups must not build indexes
+	UBYTE lazy;            // a value still to be decoded was met while ro was set
+};
+
+struct ezxml_ptask        // part of a step of a parallel query
+{
+	ezxml_t x;             // tag the step starts from, NULL for the document
+	BOOL sub;              // the step also starts from all tags below x
+};
+
+struct ezxml_pquery       // step of a query shared by the processes evaluating it
+{
+	struct SignalSemaphore lock; // guards next
+	struct Task *owner;    // task executing the query
+	LONG sig;              // signal of owner, sent as each process is done
+	ULONG running;         // processes still evaluating, changed under Forbid()
+	ezxml_t top;           // root tag of the document queried
+	struct ezxml_step *t;  // step to evaluate
+	struct ezxml_ptask *task; // parts of the step, in document order for simple steps
+	ULONG ntask;           // number of entries in task
+	ULONG tmax;            // number of entries task has room for
+	ULONG nsub;            // number of tasks with sub set
+	struct ezxml_qset *set; // result of each chunk of tasks
+	ULONG nset;            // number of chunks
+	ULONG per;             // tasks per chunk
+	ULONG next;            // next chunk to take
+	UBYTE fail;            // out of memory or lazy value met, step to be redone
+};
+
+struct ezxml_qord         // positions of tags among their siblings, by pointer hash
+{
+	ezxml_t *tag;          // tags numbered, NULL for free slots
+	ULONG *num;            // position of the tag in the same slot of tag
+	ULONG mask;            // number of slots minus one, 0 before the first use
+	ULONG n;               // number of tags numbered
+	struct LibBase *base;  // library base tag and num are allocated with
+	BOOL fail;             // out of memory, siblings are walked instead
+};
+
+struct ezxml_qkey         // query result being put in document order
+{
+	ezxml_t x;             // tag, NULL stands for the document itself
+	struct ezxml_qord *o;  // sibling positions known so far
+};
+
+struct ezxml_ient         // entry of a value index
+{
+	CONST_STRPTR key;      // attribute value or character content
+	ezxml_t xml;           // tag the key belongs to
+	ULONG hash;            // ezxml_hash() of key
+	struct ezxml_ient *next; // next entry in the same bucket, in document order
+};
+
+struct ezxml_index        // value index of a document
+{
+	struct ezxml_index *next; // next index of the same document
+	ezxml_root_t root;     // document
+	ezxml_query_t q;       // selects the indexed tags
+	STRPTR name;           // attribute or subtag name of the key
+	UBYTE type;            // EZXML_Q_ATTR, EZXML_Q_SUB or EZXML_Q_TXT
+	UBYTE pred;            // q has predicates, any change may alter the tags it selects
+	UBYTE stale;           // tree changed since the index was built
+	UBYTE sorted;          // entries are kept ordered by key too
+	struct ezxml_ient *ent; // entries in document order
+	ULONG n;               // number of entries
+	ULONG max;             // number of entries ent has room for
+	struct ezxml_ient **tab; // hash buckets
+	ULONG mask;            // number of buckets - 1
+	struct ezxml_ient **sort; // entries ordered by key, NULL if not built
 };
 
 char *EZXML_NIL[] = {NULL}; // empty, null terminated array of strings
 
+static const UBYTE ezxml_cc[256] =   // character classes used by the tokenizer
+{
+	['\0'] = EZXML_C_NUL | EZXML_C_ADEC,
+	['\t'] = EZXML_C_WS | EZXML_C_SP | EZXML_C_ADEC,
+	['\n'] = EZXML_C_WS | EZXML_C_SP | EZXML_C_ADEC,
+	['\v'] = EZXML_C_SP | EZXML_C_ADEC,
+	['\f'] = EZXML_C_SP | EZXML_C_ADEC,
+	['\r'] = EZXML_C_WS | EZXML_C_SP | EZXML_C_DEC | EZXML_C_ADEC,
+	[' ']  = EZXML_C_WS | EZXML_C_SP,
+	['&']  = EZXML_C_DEC | EZXML_C_ADEC,
+	['/']  = EZXML_C_SL,
+	['>']  = EZXML_C_GT,
+	['=']  = EZXML_C_EQ
+};
+
+static BOOL ezxml_name_index(ezxml_t xml);
+static VOID ezxml_index_touch(ezxml_t xml, UBYTE type, CONST_STRPTR name);
+static VOID ezxml_index_drop(struct ezxml_index *ix, struct LibBase *MyLibBase);
+static ezxml_t ezxml_name_get(ezxml_t xml, CONST_STRPTR name);
+static BOOL ezxml_first(ezxml_t xml);
+static VOID ezxml_vec_build(ezxml_t xml);
+static struct ezxml_sym *ezxml_sym_get(ezxml_root_t root, CONST_STRPTR name, ULONG h);
+static struct ezxml_def *ezxml_def_get(ezxml_root_t root, CONST_STRPTR tag, CONST_STRPTR name);
+static ULONG ezxml_hash(CONST_STRPTR s, ULONG l);
 ezxml_t ezxml_child(ezxml_t xml, CONST_STRPTR name);
+CONST_STRPTR ezxml_sym(ezxml_t xml, CONST_STRPTR name);
+ezxml_t ezxml_child_sym(ezxml_t xml, CONST_STRPTR sym);
 ezxml_t ezxml_idx(ezxml_t xml, ULONG idx);
+ULONG ezxml_count(ezxml_t xml);
 CONST_STRPTR ezxml_attr(ezxml_t xml, CONST_STRPTR attr);
+CONST_STRPTR ezxml_attr_sym(ezxml_t xml, CONST_STRPTR sym, struct LibBase *MyLibBase);
+ULONG ezxml_attrs_bind(ezxml_t xml, CONST_STRPTR *names, CONST_STRPTR *values, struct LibBase *MyLibBase);
+ULONG ezxml_children_bind(ezxml_t xml, CONST_STRPTR *names, ezxml_t *nodes);
+LONG ezxml_src_pos(ezxml_t xml, ULONG *off, ULONG *len);
+LONG ezxml_line_col(ezxml_t xml, ULONG *line, ULONG *col);
 ezxml_t ezxml_vget(ezxml_t xml, va_list ap);
 ezxml_t ezxml_get(ezxml_t xml, ...);
 CONST_STRPTR *ezxml_pi(ezxml_t xml, CONST_STRPTR target);
 ezxml_t ezxml_err(ezxml_root_t root, STRPTR s, CONST_STRPTR err, ...);
-STRPTR ezxml_decode(STRPTR s, STRPTR *ent, BYTE t, struct LibBase *MyLibBase);
+STRPTR ezxml_decode(STRPTR s, struct ezxml_ents *ent, BYTE t, ezxml_root_t mem, struct LibBase *MyLibBase);
 VOID ezxml_open_tag(ezxml_root_t root, STRPTR name, STRPTR *attr, struct LibBase *MyLibBase);
 VOID ezxml_char_content(ezxml_root_t root, STRPTR s, ULONG len, BYTE t, struct LibBase *MyLibBase);
-ezxml_t ezxml_close_tag(ezxml_root_t root, STRPTR name, STRPTR s);
-ULONG ezxml_ent_ok(STRPTR name, STRPTR s, STRPTR *ent);
+ezxml_t ezxml_close_tag(ezxml_root_t root, STRPTR name, STRPTR s, struct LibBase *MyLibBase);
+ULONG ezxml_ent_ok(STRPTR name, STRPTR s, struct ezxml_ents *ent, BYTE r);
 VOID ezxml_proc_inst(ezxml_root_t root, STRPTR s, ULONG len, struct LibBase *MyLibBase);
 SHORT ezxml_internal_dtd(ezxml_root_t root, STRPTR s, ULONG len, struct LibBase *MyLibBase);
 STRPTR ezxml_str2utf8(STRPTR *s, ULONG *len, struct LibBase *MyLibBase);
 VOID ezxml_free_attr(STRPTR *attr, struct LibBase *MyLibBase);
 ezxml_t ezxml_parse_str(STRPTR s, ULONG len, struct LibBase *MyLibBase);
+ezxml_t ezxml_parse_str_flags(STRPTR s, ULONG len, ULONG flags, struct LibBase *MyLibBase);
 ezxml_t ezxml_parse_fp(BPTR fp, struct LibBase *MyLibBase);
 ezxml_t ezxml_parse_fd(BPTR fd, struct LibBase *MyLibBase);
 ezxml_t ezxml_parse_file(CONST_STRPTR file, struct LibBase *MyLibBase);
-STRPTR ezxml_ampencode(CONST_STRPTR s, ULONG len, STRPTR *dst, ULONG *dlen, ULONG *max, SHORT a, struct LibBase *MyLibBase);
-STRPTR ezxml_toxml_r(ezxml_t xml, STRPTR *s, ULONG *len, ULONG *max, ULONG start, STRPTR **attr, struct LibBase *MyLibBase);
+ezxml_parser_t ezxml_parser_new(struct LibBase *MyLibBase);
+LONG ezxml_parse_chunk(ezxml_parser_t p, CONST_APTR buf, ULONG len, struct LibBase *MyLibBase);
+ezxml_t ezxml_parse_finish(ezxml_parser_t p, struct LibBase *MyLibBase);
+ezxml_t ezxml_parse_fd_overlap(BPTR fd, struct LibBase *MyLibBase);
+ezxml_reader_t ezxml_reader_open(STRPTR s, ULONG len, struct LibBase *MyLibBase);
+ezxml_event_t ezxml_reader_next(ezxml_reader_t r, struct LibBase *MyLibBase);
+CONST_STRPTR ezxml_reader_error(ezxml_reader_t r);
+VOID ezxml_reader_close(ezxml_reader_t r, struct LibBase *MyLibBase);
 STRPTR ezxml_toxml(ezxml_t xml, struct LibBase *MyLibBase);
+LONG ezxml_toxml_gz(ezxml_t xml, BPTR fd, struct LibBase *MyLibBase);
+LONG ezxml_toxml_fd(ezxml_t xml, BPTR fd, struct LibBase *MyLibBase);
+LONG ezxml_toxml_cb(ezxml_t xml, ezxml_write_f fn, APTR data, struct LibBase *MyLibBase);
 VOID ezxml_free(ezxml_t xml, struct LibBase *MyLibBase);
 CONST_STRPTR ezxml_error(ezxml_t xml);
 ezxml_t ezxml_new(CONST_STRPTR name, struct LibBase *MyLibBase);
@@ -203,6 +590,20 @@ ezxml_t ezxml_set_txt_d(ezxml_t xml, CONST_STRPTR txt, struct LibBase *MyLibBase
 ezxml_t ezxml_set_attr_d(ezxml_t xml, CONST_STRPTR name, CONST_STRPTR value, struct LibBase *MyLibBase);
 ezxml_t ezxml_move(ezxml_t xml, ezxml_t dest, ULONG off);
 VOID ezxml_remove(ezxml_t xml, struct LibBase *MyLibBase);
+ezxml_query_t ezxml_query_compile(CONST_STRPTR path, struct LibBase *MyLibBase);
+ULONG ezxml_query_exec(ezxml_t xml, ezxml_query_t q, ezxml_t *res, ULONG max, ezxml_query_f cb, APTR data, struct LibBase *MyLibBase);
+ULONG ezxml_query_exec_parallel(ezxml_t xml, ezxml_query_t q, ezxml_t *res, ULONG max, ezxml_query_f cb, APTR data,
+                                ULONG nproc, struct LibBase *MyLibBase);
+VOID ezxml_query_free(ezxml_query_t q, struct LibBase *MyLibBase);
+VOID ezxml_iter_init(struct ezxml_iter *it, ezxml_t xml);
+ezxml_t ezxml_iter_next(struct ezxml_iter *it);
+VOID ezxml_iter_skip_subtree(struct ezxml_iter *it);
+ULONG ezxml_foreach(ezxml_t xml, CONST_STRPTR path, ezxml_query_f fn, APTR data, struct LibBase *MyLibBase);
+ezxml_index_t ezxml_index_create(ezxml_t xml, CONST_STRPTR path, CONST_STRPTR key, ULONG flags, struct LibBase *MyLibBase);
+ULONG ezxml_index_get(ezxml_index_t ix, CONST_STRPTR key, ezxml_t *res, ULONG max, struct LibBase *MyLibBase);
+ULONG ezxml_index_range(ezxml_index_t ix, CONST_STRPTR lo, CONST_STRPTR hi, ezxml_t *res, ULONG max, struct LibBase *MyLibBase);
+ULONG ezxml_index_prefix(ezxml_index_t ix, CONST_STRPTR prefix, ezxml_t *res, ULONG max, struct LibBase *MyLibBase);
+VOID ezxml_index_free(ezxml_index_t ix, struct LibBase *MyLibBase);
 
 
 static inline APTR MemCopy(APTR dest, CONST_APTR src, ULONG size, struct LibBase *MyLibBase)
@@ -263,6 +664,83 @@ STRPTR StrNew(STRPTR str, struct LibBase* MyLibBase)
 	return n;
 }
 
+// skips characters of any of the given classes
+static inline STRPTR ezxml_skip(STRPTR s, UBYTE c)
+{
+	while(EZXML_CC(*s) & c) s++;
+	return s;
+}
+
+// finds the first character of any of the given classes or the null terminator
+static inline STRPTR ezxml_find(STRPTR s, UBYTE c)
+{
+	while(!(EZXML_CC(*s) & (c | EZXML_C_NUL))) s++;
+	return s;
+}
+
+typedef unsigned long __attribute__((__may_alias__)) ezxml_word;
+
+#define EZXML_ONES          (~0UL / 255)
+#define EZXML_HASZERO(v)    (((v) - EZXML_ONES) & ~(v) & (EZXML_ONES * 0x80))
+#define EZXML_HASLESS(v, n) (((v) - EZXML_ONES * (n)) & ~(v) & (EZXML_ONES * 0x80))
+
+#ifdef __ALTIVEC__
+#define EZXML_SCAN_ALIGN 16
+#else
+#define EZXML_SCAN_ALIGN sizeof(ezxml_word)
+#endif /* __ALTIVEC__ */
+
+// Finds the next c or the null terminator starting at s and returns its
+// position. f is EZXML_C_DEC for character content or EZXML_C_ADEC for
+// attribute values, it is or-ed into *seen if the skipped span contains
+// anything ezxml_decode() would change. Aligned blocks of the input are tested
+// as a whole, one AltiVec vector or machine word at a time, and only blocks
+// holding the stop character are walked bytewise. Nothing at or after e is read.
+static STRPTR ezxml_scan(STRPTR s, STRPTR e, UBYTE c, UBYTE f, UBYTE *seen)
+{
+#ifdef __ALTIVEC__
+	union { vector unsigned char v; UBYTE b[16]; } vc, va, vr;
+	vector unsigned char v, z = vec_splat_u8(0), lt = vec_splat_u8(14);
+#else
+	const ezxml_word vc = EZXML_ONES * c, va = EZXML_ONES * '&', vr = EZXML_ONES * '\r';
+	ezxml_word v;
+#endif /* __ALTIVEC__ */
+	UBYTE m = 0;
+
+#ifdef __ALTIVEC__
+	memset(vc.b, c, 16);
+	memset(va.b, '&', 16);
+	memset(vr.b, '\r', 16);
+#endif /* __ALTIVEC__ */
+
+	for(; ; s++)
+	{
+		if(!((IPTR)s & (EZXML_SCAN_ALIGN - 1)))    // aligned, test whole blocks
+		{
+			for(; s + EZXML_SCAN_ALIGN <= e; s += EZXML_SCAN_ALIGN)
+			{
+#ifdef __ALTIVEC__
+				v = vec_ld(0, (UBYTE *)s);
+				if(vec_any_eq(v, z) || vec_any_eq(v, vc.v)) break;  // stop inside
+				if(vec_any_eq(v, va.v) || ((f == EZXML_C_DEC) ? vec_any_eq(v, vr.v)
+				                           : vec_any_lt(v, lt))) m = f;
+#else
+				v = *(ezxml_word *)s;
+				if(EZXML_HASZERO(v) || EZXML_HASZERO(v ^ vc)) break;  // stop inside
+				if(EZXML_HASZERO(v ^ va) || ((f == EZXML_C_DEC) ? EZXML_HASZERO(v ^ vr)
+				                             : EZXML_HASLESS(v, 14))) m = f;
+#endif /* __ALTIVEC__ */
+			}
+		}
+
+		if(!*s || *s == (char)c) break;
+		m |= EZXML_CC(*s) & f;
+	}
+
+	*seen |= m;
+	return s;
+}
+
 //+ ezxml.library/ezxml_child
 /****** ezxml.library/ezxml_child *********************************************
 * NAME
@@ -283,6 +761,10 @@ STRPTR StrNew(STRPTR str, struct LibBase* MyLibBase)
 * RESULT
 *	Return a ezxml_t structure of found tag or NULL on failure.
 *
+* NOTES
+*  Tags with many different subtag names get a name index the first time they
+*  are searched, later searches take constant time.
+*
 * SEE ALSO
 *  ezxml_next() ezxml_idx()
 ********************************************************************************
@@ -291,9 +773,93 @@ STRPTR StrNew(STRPTR str, struct LibBase* MyLibBase)
 //-
 ezxml_t ezxml_child(ezxml_t xml, CONST_STRPTR name)
 {
-	xml = (xml) ? xml->child : NULL;
-	while(xml && strcmp(name, xml->name)) xml = xml->sibling;
-	return xml;
+	return (xml) ? ezxml_name_get(xml, name) : NULL;
+}
+
+//+ ezxml.library/ezxml_sym
+/****** ezxml.library/ezxml_sym ************************************************
+* NAME
+*  ezxml_sym() - looks up an interned name (V9)
+*
+* SYNOPSIS
+*  ezxml_sym(xml, name);
+*  CONST_STRPTR ezxml_sym(ezxml_t, CONST_STRPTR);
+*
+* FUNCTION
+*  All parsed tags and attributes of the same name share one copy of the name.
+*  This function returns that copy, which can be given to ezxml_child_sym()
+*  and ezxml_attr_sym() to find tags and attributes by comparing pointers.
+*
+* INPUTS
+*  xml  - any tag of a parsed document
+*  name - name of a tag or an attribute
+*
+* RESULT
+*	Returns the shared copy of the name or NULL if no parsed tag or attribute of
+*	the document has that name.
+*
+* NOTES
+*  The result is valid as long as the document.
+*
+* SEE ALSO
+*  ezxml_child_sym() ezxml_attr_sym()
+********************************************************************************
+*
+*/
+//-
+CONST_STRPTR ezxml_sym(ezxml_t xml, CONST_STRPTR name)
+{
+	struct ezxml_sym *y;
+
+	if(!xml || !name) return NULL;
+	y = ezxml_sym_get(EZXML_DOC(xml), name, ezxml_hash(name, strlen(name)));
+	return (y) ? y->name : NULL;
+}
+
+//+ ezxml.library/ezxml_child_sym
+/****** ezxml.library/ezxml_child_sym ******************************************
+* NAME
+*  ezxml_child_sym() - searches for a child tag by interned name (V9)
+*
+* SYNOPSIS
+*  ezxml_child_sym(xml, sym);
+*  ezxml_t ezxml_child_sym(ezxml_t, CONST_STRPTR);
+*
+* FUNCTION
+*  Works like ezxml_child(), but compares the name returned by ezxml_sym()
+*  with the names of the subtags by pointer.
+*
+* INPUTS
+*  xml - ezxml_t structure
+*  sym - name returned by ezxml_sym() for the document of xml
+*
+* RESULT
+*	Return a ezxml_t structure of found tag or NULL on failure.
+*
+* NOTES
+*  Tags added with ezxml_add_child() are found only if they were given the
+*  name returned by ezxml_sym().
+*
+* SEE ALSO
+*  ezxml_sym() ezxml_child()
+********************************************************************************
+*
+*/
+//-
+ezxml_t ezxml_child_sym(ezxml_t xml, CONST_STRPTR sym)
+{
+	struct ezxml_node *n = EZXML_NODE(xml);
+	ezxml_t cur;
+
+	if(!xml || !sym) return NULL;
+	if(n->names > EZXML_NAMEIDX && (n->htab || ezxml_name_index(xml)))
+	{
+		for(cur = n->htab[ezxml_hash(sym, strlen(sym)) & n->hmask];
+		        cur && cur->name != sym; cur = EZXML_NODE(cur)->hnext);
+		return cur;
+	}
+	for(cur = xml->child; cur && cur->name != sym; cur = cur->sibling);
+	return cur;
 }
 
 //+ ezxml.library/ezxml_idx
@@ -317,6 +883,8 @@ ezxml_t ezxml_child(ezxml_t xml, CONST_STRPTR name)
 *
 * NOTES
 *  An index of 0 returns the tag given.
+*  Indexing from the first tag of a name, as returned by ezxml_child(), builds
+*  a table of the tags of that name, later calls take constant time.
 *
 * SEE ALSO
 *  ezxml_child() ezxml_next()
@@ -326,10 +894,82 @@ ezxml_t ezxml_child(ezxml_t xml, CONST_STRPTR name)
 //-
 ezxml_t ezxml_idx(ezxml_t xml, ULONG idx)
 {
+	struct ezxml_node *n = EZXML_NODE(xml);
+
+	if(xml && !n->vec && idx >= EZXML_VECMIN && ezxml_first(xml)) ezxml_vec_build(xml);
+	if(xml && n->vec) return (idx < n->count) ? n->vec[idx] : NULL;
 	for(; xml && idx; idx--) xml = xml->next;
 	return xml;
 }
 
+//+ ezxml.library/ezxml_count
+/****** ezxml.library/ezxml_count **********************************************
+* NAME
+*  ezxml_count() - counts tags with this same name (V9)
+*
+* SYNOPSIS
+*  ezxml_count(xml)
+*  ULONG ezxml_count(ezxml_t)
+*
+* FUNCTION
+*  Counts the given tag and the tags of the same name following it in the same
+*  section and depth.
+*
+* INPUTS
+*  xml - ezxml_t structure
+*
+* RESULT
+*	Returns the number of tags, 0 if xml is NULL.
+*
+* NOTES
+*  Takes constant time for the first tag of a name, as returned by
+*  ezxml_child().
+*
+* SEE ALSO
+*  ezxml_child() ezxml_idx() ezxml_next()
+********************************************************************************
+*
+*/
+//-
+ULONG ezxml_count(ezxml_t xml)
+{
+	ULONG n = 0;
+
+	if(xml && ezxml_first(xml)) return EZXML_NODE(xml)->count;
+	for(; xml; xml = xml->next) n++;
+	return n;
+}
+
+// Returns the value of the i-th name of the attribute list of xml, decoding it
+// first if the document was parsed lazily and that is still pending.
+static CONST_STRPTR ezxml_attr_val(ezxml_t xml, ULONG i, struct LibBase *MyLibBase)
+{
+	ULONG j;
+	STRPTR m;
+
+	if(EZXML_DOC(xml)->mode & EZXML_PARSE_LAZY)
+	{
+		for(j = i; xml->attr[j]; j += 2);  // find end of attribute list
+		if(*(m = xml->attr[j + 1] + i / 2) & EZXML_TXTD)    // decode now
+		{
+			xml->attr[i + 1] = ezxml_decode(xml->attr[i + 1], &EZXML_DOC(xml)->ent,
+			                                (*m & EZXML_TXTN) ? '*' : ' ',
+			                                EZXML_DOC(xml), MyLibBase);
+			*m &= ~(EZXML_TXTD | EZXML_TXTN);
+		}
+	}
+	return xml->attr[i + 1];
+}
+
+// Returns the default value of attribute attr of tag xml, NULL if there is none.
+// The defaults are those of the document the tag belongs to.
+static CONST_STRPTR ezxml_attr_def(ezxml_t xml, CONST_STRPTR attr)
+{
+	struct ezxml_def *y = ezxml_def_get(EZXML_DOC(xml), xml->name, attr);
+
+	return (y) ? y->value : NULL;
+}
+
 //+ ezxml.library/ezxml_attr
 /****** ezxml.library/ezxml_attr ***********************************************
 * NAME
@@ -351,6 +991,8 @@ ezxml_t ezxml_idx(ezxml_t xml, ULONG idx)
 *
 * NOTES
 *  Return NULL if not found.
+*  Values of documents parsed with EZXML_PARSE_LAZY are decoded by the first
+*  call asking for them.
 *
 * SEE ALSO
 *  ezxml_get()
@@ -360,326 +1002,1090 @@ ezxml_t ezxml_idx(ezxml_t xml, ULONG idx)
 //-
 CONST_STRPTR ezxml_attr(ezxml_t xml, CONST_STRPTR attr)
 {
-	ULONG i = 0, j = 1;
-	ezxml_root_t root = (ezxml_root_t)xml;
+	ULONG i = 0;
 
 	if(!xml || !xml->attr) return NULL;
 	while(xml->attr[i] && strcmp(attr, xml->attr[i])) i += 2;
-	if(xml->attr[i]) return xml->attr[i + 1];  // found attribute
-
-	while(root->xml.parent) root = (ezxml_root_t)root->xml.parent;  // root tag
-	for(i = 0; root->attr[i] && strcmp(xml->name, root->attr[i][0]); i++);
-	if(!root->attr[i]) return NULL;  // no matching default attributes
-	while(root->attr[i][j] && strcmp(attr, root->attr[i][j])) j += 3;
-	return (root->attr[i][j]) ? root->attr[i][j + 1] : NULL; // found default
-}
-
-// same as ezxml_get but takes an already initialized va_list
-ezxml_t ezxml_vget(ezxml_t xml, va_list ap)
-{
-	STRPTR name = va_arg(ap, STRPTR);
-	LONG idx = -1;
-
-	if(name && *name)
-	{
-		idx = va_arg(ap, int);
-		xml = ezxml_child(xml, name);
-	}
-	return (idx < 0) ? xml : ezxml_vget(ezxml_idx(xml, idx), ap);
+	if(xml->attr[i]) return ezxml_attr_val(xml, i, EZXML_DOC(xml)->base);  // found attribute
+	return ezxml_attr_def(xml, attr);
 }
 
-//+ ezxml.library/ezxml_get
-/****** ezxml.library/ezxml_get ***********************************************
+//+ ezxml.library/ezxml_attr_sym
+/****** ezxml.library/ezxml_attr_sym *******************************************
 * NAME
-*  ezxml_get() - traverses the ezxml sturcture to retrieve a specific subtag (V8)
+*  ezxml_attr_sym() - reads value of attribute by interned name (V9)
 *
 * SYNOPSIS
-*  ezxml_get(xml, ...);
-*  ezxml_t ezxml_get(ezxml_t, ...);
+* ezxml_attr_sym(xml, sym);
+* CONST_STRPTR ezxml_attr_sym(ezxml_t, CONST_STRPTR);
 *
 * FUNCTION
-*  Traverses the ezxml sturcture to retrieve a specific subtag. Takes a
-*  variable length list of tag names and indexes. The argument list must be
-*  terminated by either an index of -1 or an empty string tag name.
+*  Works like ezxml_attr(), but compares the name returned by ezxml_sym()
+*  with the attribute names of the tag by pointer.
 *
 * INPUTS
 *  xml - ezxml_t tag structure
-*  ... - variable length list of tag names and indexes
+*  sym - name returned by ezxml_sym() for the document of xml
 *
 * RESULT
-*	Return a pointer to ezxml_t contains requested tag.
+*	Return a pointer to string contains value of requested tag attribute.
 *
 * NOTES
-*  Don't forget to end list of parameters with -1!
-*  Returns NULL if not found.
+*  Return NULL if not found. Attributes set with ezxml_set_attr() are found only
+*  if they were given the name returned by ezxml_sym(). Default values declared
+*  in the DTD are found as with ezxml_attr().
 *
 * SEE ALSO
-*  ezxml_attr()
-*
-* EXAMPLE
-*  title = ezxml_get(library, "shelf", 0, "book", 2, "title", -1);
-*  This retrieves the title of the 3rd book on the 1st shelf of library.
+*  ezxml_sym() ezxml_attr()
 ********************************************************************************
 *
 */
 //-
-ezxml_t ezxml_get(ezxml_t xml, ...)
+CONST_STRPTR ezxml_attr_sym(ezxml_t xml, CONST_STRPTR sym, struct LibBase *MyLibBase)
 {
-	va_list ap;
-	ezxml_t r;
+	ULONG i = 0;
 
-	va_start(ap, xml);
-	r = ezxml_vget(xml, ap);
-	va_end(ap);
-	return r;
+	if(!xml || !xml->attr || !sym) return NULL;
+	while(xml->attr[i] && xml->attr[i] != sym) i += 2;
+	if(xml->attr[i]) return ezxml_attr_val(xml, i, MyLibBase);  // found attribute
+	return ezxml_attr_def(xml, sym);
 }
 
-//+ ezxml.library/ezxml_pi
-/****** ezxml.library/ezxml_pi **************************************************
+// Returns TRUE if name s equals t, which may be the same interned string.
+static inline BOOL ezxml_name_eq(CONST_STRPTR s, CONST_STRPTR t)
+{
+	return (s == t || (*s == *t && !strcmp(s, t)));
+}
+
+//+ ezxml.library/ezxml_attrs_bind
+/****** ezxml.library/ezxml_attrs_bind *****************************************
 * NAME
-*  ezxml_pi() - returns a NULL terminated array of processing instructions for the given target (V8)
+*  ezxml_attrs_bind() - reads values of many attributes at once (V9)
 *
 * SYNOPSIS
-*  ezxml_pi(xml, target);
-*  CONST_STRPTR *ezxml_pi(ezxml_t, CONST_STRPTR);
+*  ezxml_attrs_bind(xml, names, values)
+*  ULONG ezxml_attrs_bind(ezxml_t, CONST_STRPTR *, CONST_STRPTR *)
+*
+* FUNCTION
+*  Reads the values of all attributes listed in names, as ezxml_attr() would
+*  for each of them, with a single pass over the attributes of the tag.
 *
 * INPUTS
-*  xml    - ezxml_t tag structure
-*  target - pointer to string obtaining target
+*  xml - ezxml_t tag structure
+*  names - NULL terminated array of attribute names, names returned by
+*          ezxml_sym() compare fastest
+*  values - array with an entry per name, set to the value of the attribute
+*           or NULL if not found
 *
 * RESULT
-*	Returns a NULL terminated array of processing instructions for the given target
+*	Returns the number of attributes found.
+*
+* EXAMPLE
+*  CONST_STRPTR names[] = {"id", "name", "type", NULL}, values[3];
+*
+*  ezxml_attrs_bind(xml, names, values);
+*
+* SEE ALSO
+*  ezxml_attr() ezxml_children_bind()
 ********************************************************************************
 *
 */
 //-
-CONST_STRPTR *ezxml_pi(ezxml_t xml, CONST_STRPTR target)
+ULONG ezxml_attrs_bind(ezxml_t xml, CONST_STRPTR *names, CONST_STRPTR *values, struct LibBase *MyLibBase)
 {
-	ezxml_root_t root = (ezxml_root_t)xml;
-	int i = 0;
+	ULONG i, j, k, n = 0;
 
-	if(!root) return (const char **)EZXML_NIL;
-	while(root->xml.parent) root = (ezxml_root_t)root->xml.parent;  // root tag
-	while(root->pi[i] && strcmp(target, root->pi[i][0])) i++;  // find target
-	return (const char **)((root->pi[i]) ? root->pi[i] + 1 : EZXML_NIL);
+	if(!names) return 0;
+	for(k = 0; names[k]; k++) values[k] = NULL;
+	if(!xml || !xml->attr) return 0;
+
+	for(i = 0; xml->attr[i] && n < k; i += 2)    // one pass over the attributes
+		for(j = 0; j < k; j++)
+			if(!values[j] && ezxml_name_eq(names[j], xml->attr[i]))
+			{
+				values[j] = ezxml_attr_val(xml, i, MyLibBase);
+				n++;
+			}
+
+	for(j = 0; j < k && n < k; j++)    // default values declared in the DTD
+		if(!values[j] && (values[j] = ezxml_attr_def(xml, names[j]))) n++;
+	return n;
 }
 
-// set an error string and return root
-ezxml_t ezxml_err(ezxml_root_t root, STRPTR s, CONST_STRPTR err, ...)
+//+ ezxml.library/ezxml_children_bind
+/****** ezxml.library/ezxml_children_bind **************************************
+* NAME
+*  ezxml_children_bind() - finds subtags of many names at once (V9)
+*
+* SYNOPSIS
+*  ezxml_children_bind(xml, names, nodes)
+*  ULONG ezxml_children_bind(ezxml_t, CONST_STRPTR *, ezxml_t *)
+*
+* FUNCTION
+*  Finds the first subtag of each name listed in names, as ezxml_child() would
+*  for each of them, with a single pass over the subtag names of the tag.
+*
+* INPUTS
+*  xml - ezxml_t tag structure
+*  names - NULL terminated array of tag names, names returned by ezxml_sym()
+*          compare fastest
+*  nodes - array with an entry per name, set to the first subtag of that name
+*          or NULL if not found
+*
+* RESULT
+*	Returns the number of subtags found.
+*
+* NOTES
+*  Takes a step per distinct subtag name, not per subtag. Tags with many
+*  distinct subtag names are searched by their name index instead.
+*
+* SEE ALSO
+*  ezxml_child() ezxml_attrs_bind()
+********************************************************************************
+*
+*/
+//-
+ULONG ezxml_children_bind(ezxml_t xml, CONST_STRPTR *names, ezxml_t *nodes)
 {
-	va_list ap;
-	int line = 1;
-	STRPTR *t;
-	BYTE fmt[EZXML_ERRL];
-
-	for(t = root->s; t < s; t++) if(*t == '\n') line++;
-	snprintf(fmt, EZXML_ERRL, "[error near line %d]: %s", line, err);
+	ULONG j, k, n = 0;
+	ezxml_t cur;
 
-	va_start(ap, err);
-	vsnprintf(root->err, EZXML_ERRL, fmt, ap);
-	va_end(ap);
+	if(!names) return 0;
+	for(k = 0; names[k]; k++) nodes[k] = NULL;
+	if(!xml) return 0;
 
-	return &root->xml;
+	if(EZXML_NODE(xml)->names > EZXML_NAMEIDX)    // indexed by name
+	{
+		for(j = 0; j < k; j++)
+			if((nodes[j] = ezxml_name_get(xml, names[j]))) n++;
+		return n;
+	}
+	for(cur = xml->child; cur && n < k; cur = cur->sibling)    // first tag of each name
+		for(j = 0; j < k; j++)
+			if(!nodes[j] && ezxml_name_eq(names[j], cur->name))
+			{
+				nodes[j] = cur;
+				n++;
+			}
+	return n;
 }
 
-// Recursively decodes entity and character references and normalizes new lines
-// ent is a null terminated array of alternating entity names and values. set t
-// to '&' for general entity decoding, '%' for parameter entity decoding, 'c'
-// for cdata sections, ' ' for attribute normalization, or '*' for non-cdata
-// attribute normalization. Returns s, or if the decoded string is longer than
-// s, returns a malloced string that must be freed.
-STRPTR ezxml_decode(STRPTR s, STRPTR *ent, BYTE t, struct LibBase *MyLibBase)
+// same as ezxml_get but takes an already initialized va_list
+ezxml_t ezxml_vget(ezxml_t xml, va_list ap)
 {
-	STRPTR e, r = s, m = s;
-	long b, c, d, l;
+	STRPTR name = va_arg(ap, STRPTR);
+	LONG idx = -1;
 
-	for(; *s; s++)    // normalize line endings
+	if(name && *name)
 	{
-		while(*s == '\r')
-		{
-			*(s++) = '\n';
-			if(*s == '\n') memmove(s, (s + 1), strlen(s));
-		}
+		idx = va_arg(ap, int);
+		xml = ezxml_child(xml, name);
 	}
+	return (idx < 0) ? xml : ezxml_vget(ezxml_idx(xml, idx), ap);
+}
 
-	for(s = r; ;)
-	{
-		while(*s && *s != '&' && (*s != '%' || t != '%') && !isspace(*s)) s++;
+//+ ezxml.library/ezxml_get
+/****** ezxml.library/ezxml_get ***********************************************
+* NAME
+*  ezxml_get() - traverses the ezxml sturcture to retrieve a specific subtag (V8)
+*
+* SYNOPSIS
+*  ezxml_get(xml, ...);
+*  ezxml_t ezxml_get(ezxml_t, ...);
+*
+* FUNCTION
+*  Traverses the ezxml sturcture to retrieve a specific subtag. Takes a
+*  variable length list of tag names and indexes. The argument list must be
+*  terminated by either an index of -1 or an empty string tag name.
+*
+* INPUTS
+*  xml - ezxml_t tag structure
+*  ... - variable length list of tag names and indexes
+*
+* RESULT
+*	Return a pointer to ezxml_t contains requested tag.
+*
+* NOTES
+*  Don't forget to end list of parameters with -1!
+*  Returns NULL if not found.
+*
+* SEE ALSO
+*  ezxml_attr()
+*
+* EXAMPLE
+*  title = ezxml_get(library, "shelf", 0, "book", 2, "title", -1);
+*  This retrieves the title of the 3rd book on the 1st shelf of library.
+********************************************************************************
+*
+*/
+//-
+ezxml_t ezxml_get(ezxml_t xml, ...)
+{
+	va_list ap;
+	ezxml_t r;
 
-		if(!*s) break;
-		else if(t != 'c' && !strncmp(s, "&#", 2))    // character reference
-		{
-			if(s[2] == 'x') c = strtol(s + 3, &e, 16);  // base 16
-			else c = strtol(s + 2, &e, 10); // base 10
-			if(!c || *e != ';')
-			{
-				s++;    // not a character ref
-				continue;
-			}
-			if(c < 0x80) *(s++) = c;  // US-ASCII subset
-			else   // multi-byte UTF-8 sequence
-			{
-				for(b = 0, d = c; d; d /= 2) b++;  // number of bits in c
-				b = (b - 2) / 5; // number of bytes in payload
-				*(s++) = (0xFF << (7 - b)) | (c >> (6 * b)); // head
-				while(b) *(s++) = 0x80 | ((c >> (6 * --b)) & 0x3F);  // payload
-			}
+	va_start(ap, xml);
+	r = ezxml_vget(xml, ap);
+	va_end(ap);
+	return r;
+}
 
-			memmove(s, strchr(s, ';') + 1, strlen(strchr(s, ';')));
-		}
-		else if((*s == '&' && (t == '&' || t == ' ' || t == '*')) ||
-		        (*s == '%' && t == '%'))   // entity reference
-		{
-			for(b = 0; ent[b] && strncmp(s + 1, ent[b], strlen(ent[b]));
-			        b += 2); // find entity in entity list
+//+ ezxml.library/ezxml_pi
+/****** ezxml.library/ezxml_pi **************************************************
+* NAME
+*  ezxml_pi() - returns a NULL terminated array of processing instructions for the given target (V8)
+*
+* SYNOPSIS
+*  ezxml_pi(xml, target);
+*  CONST_STRPTR *ezxml_pi(ezxml_t, CONST_STRPTR);
+*
+* INPUTS
+*  xml    - ezxml_t tag structure
+*  target - pointer to string obtaining target
+*
+* RESULT
+*	Returns a NULL terminated array of processing instructions for the given target
+********************************************************************************
+*
+*/
+//-
+CONST_STRPTR *ezxml_pi(ezxml_t xml, CONST_STRPTR target)
+{
+	ezxml_root_t root;
+	int i = 0;
 
-			if(ent[b++])    // found a match
-			{
-				if((c = strlen(ent[b])) - 1 > (e = strchr(s, ';')) - s)
-				{
-					l = (d = (s - r)) + c + strlen(e); // new length
-					r = (r == m) ? strcpy(malloc(l), r) : realloc(r, l);
-					e = strchr((s = r + d), ';'); // fix up pointers
-				}
+	if(!xml) return (const char **)EZXML_NIL;
+	root = EZXML_DOC(xml);
+	while(root->pi[i] && strcmp(target, root->pi[i][0])) i++;  // find target
+	return (const char **)((root->pi[i]) ? root->pi[i] + 1 : EZXML_NIL);
+}
 
-				memmove(s + c, e + 1, strlen(e)); // shift rest of string
-				strncpy(s, ent[b], c); // copy in replacement text
-			}
-			else s++; // not a known entity
-		}
-		else if((t == ' ' || t == '*') && isspace(*s)) *(s++) = ' ';
-		else s++; // no decoding needed
-	}
+// Adds the line breaks of the work area of root up to s to its line index.
+// Called before parsing turns any of them into terminators. Returns FALSE if
+// out of memory.
+static BOOL ezxml_lines_to(ezxml_root_t root, STRPTR s)
+{
+	struct LibBase *MyLibBase = root->base;
+	STRPTR t = (root->nlto > root->off) ? root->s + (root->nlto - root->off) : root->s;
+	ULONG *nl, max;
 
-	if(t == '*')    // normalize spaces for non-cdata attributes
+	for(; t < s && (t = memchr(t, '\n', s - t)); t++)
 	{
-		for(s = r; *s; s++)
+		if(root->nls == root->nlmax)
 		{
-			if((l = strspn(s, " "))) memmove(s, s + l, strlen(s + l) + 1);
-			while(*s && *s != ' ') s++;
+			max = (root->nlmax) ? root->nlmax * 2 : EZXML_BUFSIZE;
+			if(!(nl = (root->nl) ? realloc(root->nl, max * sizeof(ULONG)) : malloc(max * sizeof(ULONG))))
+				return FALSE;
+			root->nl = nl;
+			root->nlmax = max;
 		}
-		if(--s >= r && *s == ' ') *s = '\0';  // trim any trailing space
+		root->nl[root->nls++] = root->off + (t - root->s);
 	}
-	return r;
+	root->nlto = root->off + (s - root->s);
+	return TRUE;
 }
 
-// called when parser finds start of new tag
-VOID ezxml_open_tag(ezxml_root_t root, STRPTR name, STRPTR *attr, struct LibBase *MyLibBase)
+// Returns the number of line breaks of the input of root before offset off.
+static ULONG ezxml_lines_before(ezxml_root_t root, ULONG off)
 {
-	ezxml_t xml = root->cur;
-
-	if(xml->name) xml = ezxml_add_child(xml, name, strlen(xml->txt), MyLibBase);
-	else xml->name = name; // first open tag
+	ULONG lo = 0, hi, m;
 
-	xml->attr = attr;
-	root->cur = xml; // update tag insertion point
+	for(hi = root->nls; lo < hi; )    // first line break at or after off
+	{
+		m = (lo + hi) / 2;
+		if(root->nl[m] < off) lo = m + 1;
+		else hi = m;
+	}
+	return lo;
 }
 
-// called when parser finds character content between open and closing tag
-VOID ezxml_char_content(ezxml_root_t root, STRPTR s, ULONG len, BYTE t, struct LibBase *MyLibBase)
+// set an error string and return root
+ezxml_t ezxml_err(ezxml_root_t root, STRPTR s, CONST_STRPTR err, ...)
 {
-	ezxml_t xml = root->cur;
-	char *m = s;
-	ULONG l;
-
-	if(!xml || !xml->name || !len) return;  // sanity check
+	va_list ap;
+	ULONG line = 1;
+	BYTE fmt[EZXML_ERRL];
 
-	s[len] = '\0'; // null terminate text (calling functions anticipate this)
-	len = strlen(s = ezxml_decode(s, root->ent, t, MyLibBase)) + 1;
+	if(s && root->s && s >= root->s && s <= root->e)
+		line += ezxml_lines_before(root, root->off + (s - root->s));
+	snprintf(fmt, EZXML_ERRL, "[error near line %lu]: %s", line, err);
 
-	if(!*(xml->txt)) xml->txt = s;  // initial character content
-	else   // allocate our own memory and make a copy
-	{
-		xml->txt = (xml->flags & EZXML_TXTM) // allocate some space
-		           ? realloc(xml->txt, (l = strlen(xml->txt)) + len)
-		           : strcpy(malloc((l = strlen(xml->txt)) + len), xml->txt);
-		strcpy(xml->txt + l, s); // add new char content
-		if(s != m) free(s);  // free s if it was malloced by ezxml_decode()
-	}
+	va_start(ap, err);
+	vsnprintf(root->err, EZXML_ERRL, fmt, ap);
+	va_end(ap);
 
-	if(xml->txt != m) ezxml_set_flag(xml, EZXML_TXTM);
+	return &root->xml;
 }
 
-// called when parser finds closing tag
-ezxml_t ezxml_close_tag(ezxml_root_t root, STRPTR name, STRPTR s)
+//+ ezxml.library/ezxml_src_pos
+/****** ezxml.library/ezxml_src_pos **************************************
+* NAME
+*  ezxml_src_pos() - gets where a tag was read from (V9)
+*
+* SYNOPSIS
+*  ezxml_src_pos(xml, off, len)
+*  LONG ezxml_src_pos(ezxml_t, ULONG *, ULONG *)
+*
+* FUNCTION
+*  Gets the byte offset of the start tag of xml in the parsed input and the
+*  number of bytes from there up to and including the end of its end tag.
+*
+* INPUTS
+*  xml - ezxml_t tag structure
+*  off - pointer to the offset of the '<' of the start tag, may be NULL
+*  len - pointer to the length of the tag in the input, may be NULL. Set to 0
+*        while the tag is not closed yet.
+*
+* RESULT
+*	Returns FALSE if the tag was not read from an input, but added later.
+*
+* NOTES
+*  Offsets of UTF-16 input are counted in its UTF-8 conversion.
+*
+* SEE ALSO
+*  ezxml_line_col()
+********************************************************************************
+*
+*/
+//-
+LONG ezxml_src_pos(ezxml_t xml, ULONG *off, ULONG *len)
 {
-	if(!root->cur || !root->cur->name || strcmp(name, root->cur->name))
-		return ezxml_err(root, s, "unexpected closing tag </%s>", name);
+	if(!xml || EZXML_NODE(xml)->pos == EZXML_NOPOS) return FALSE;
+	if(off) *off = EZXML_NODE(xml)->pos;
+	if(len) *len = EZXML_NODE(xml)->slen;
+	return TRUE;
+}
 
-	root->cur = root->cur->parent;
-	return NULL;
+//+ ezxml.library/ezxml_line_col
+/****** ezxml.library/ezxml_line_col **************************************
+* NAME
+*  ezxml_line_col() - gets the line and column of a tag in the input (V9)
+*
+* SYNOPSIS
+*  ezxml_line_col(xml, line, col)
+*  LONG ezxml_line_col(ezxml_t, ULONG *, ULONG *)
+*
+* FUNCTION
+*  Gets the line and column of the '<' of the start tag of xml in the parsed
+*  input. Both count from 1, columns in bytes.
+*
+* INPUTS
+*  xml - ezxml_t tag structure
+*  line - pointer to the line number, may be NULL
+*  col - pointer to the column, may be NULL
+*
+* RESULT
+*	Returns FALSE if the tag was not read from an input, but added later.
+*
+* NOTES
+*  The line breaks of the input are indexed before parsing, each call is a
+*  binary search.
+*
+* SEE ALSO
+*  ezxml_src_pos() ezxml_parse_str_flags()
+********************************************************************************
+*
+*/
+//-
+LONG ezxml_line_col(ezxml_t xml, ULONG *line, ULONG *col)
+{
+	ezxml_root_t root;
+	ULONG pos, n;
+
+	if(!xml || (pos = EZXML_NODE(xml)->pos) == EZXML_NOPOS) return FALSE;
+	root = EZXML_DOC(xml);
+	n = ezxml_lines_before(root, pos);
+	if(line) *line = n + 1;
+	if(col) *col = (n) ? pos - root->nl[n - 1] : pos + 1;
+	return TRUE;
 }
 
-// checks for circular entity references, returns non-zero if no circular
-// references are found, zero otherwise
-ULONG ezxml_ent_ok(STRPTR name, STRPTR s, STRPTR *ent)
+// Allocates a chunk of size bytes for the arena of a document, of which used
+// bytes are handed out already. Returns NULL if out of memory.
+static struct ezxml_chunk *ezxml_chunk(ULONG size, ULONG used, struct LibBase *MyLibBase)
 {
-	int i;
+	struct ezxml_chunk *c;
 
-	for(; ; s++)
-	{
-		while(*s && *s != '&') s++;  // find next entity reference
-		if(!*s) return 1;
-		if(!strncmp(s + 1, name, strlen(name))) return 0;  // circular ref.
-		for(i = 0; ent[i] && strncmp(ent[i], s + 1, strlen(ent[i])); i += 2);
-		if(ent[i] && !ezxml_ent_ok(name, ent[i + 1], ent)) return 0;
-	}
+	if(!(c = malloc(sizeof(struct ezxml_chunk) + size))) return NULL;  // cleared
+	c->size = size;
+	c->used = used;
+	return c;
 }
 
-// called when the parser finds a processing instruction
-VOID ezxml_proc_inst(ezxml_root_t root, STRPTR s, ULONG len, struct LibBase *MyLibBase)
+// Allocates n bytes of cleared memory from the arena of document root. The
+// memory is released together with the document. Returns NULL if out of memory.
+static APTR ezxml_alloc(ezxml_root_t root, ULONG n, struct LibBase *MyLibBase)
 {
-	int i = 0, j = 1;
-	char *target = s;
+	struct ezxml_chunk *c = root->mem, *b;
+	ULONG m = c->size;
 
-	s[len] = '\0'; // null terminate instruction
-	if(*(s += strcspn(s, EZXML_WS)))
+	n = EZXML_ALIGN(n);
+	if(m - c->used >= n)    // fits into the current chunk
 	{
-		*s = '\0'; // null terminate target
-		s += strspn(s + 1, EZXML_WS) + 1; // skip whitespace after target
+		c->used += n;
+		return EZXML_MEM(c) + c->used - n;
 	}
 
-	if(!strcmp(target, "xml"))    // <?xml ... ?>
+	if(n > m / 4)    // big blocks get a chunk of their own
 	{
-		if((s = strstr(s, "standalone")) && !strncmp(s + strspn(s + 10,
-		        EZXML_WS "='\"") + 10, "yes", 3)) root->standalone = 1;
-		return;
+		if(!(b = ezxml_chunk(n, n, MyLibBase))) return NULL;
+		b->next = c->next; // keep filling the current chunk
+		c->next = b;
+		return EZXML_MEM(b);
 	}
 
-	if(!root->pi[0]) *(root->pi = malloc(sizeof(char **))) = NULL;  //first pi
+	if(m < EZXML_CHUNKMAX) m *= 2;
+	if(!(b = ezxml_chunk(m, n, MyLibBase))) return NULL;
+	b->next = c;
+	root->mem = b;
+	return EZXML_MEM(b);
+}
 
-	while(root->pi[i] && strcmp(target, root->pi[i][0])) i++;  // find target
-	if(!root->pi[i])    // new target
-	{
-		root->pi = realloc(root->pi, sizeof(char **) * (i + 2));
-		root->pi[i] = malloc(sizeof(char *) * 3);
-		root->pi[i][0] = target;
-		root->pi[i][1] = (char *)(root->pi[i + 1] = NULL); // terminate pi list
-		root->pi[i][2] = strdup(""); // empty document position list
-	}
+// predefined entities, placed by the perfect hash in ezxml_ent_std()
+static const struct ezxml_std
+{
+	CONST_STRPTR name;     // name followed by ';'
+	UBYTE len;             // length of name, including the ';'
+	UBYTE c;               // character the entity stands for
+} ezxml_std[8] =
+{
+	{ "lt;", 3, '<' }, { "quot;", 5, '"' }, { NULL, 0, 0 }, { "amp;", 4, '&' },
+	{ "apos;", 5, '\'' }, { NULL, 0, 0 }, { "gt;", 3, '>' }, { NULL, 0, 0 }
+};
 
-	while(root->pi[i][j]) j++;  // find end of instruction list for this target
-	root->pi[i] = realloc(root->pi[i], sizeof(char *) * (j + 3));
-	root->pi[i][j + 2] = realloc(root->pi[i][j + 1], j + 1);
-	strcpy(root->pi[i][j + 2] + j - 1, (root->xml.name) ? ">" : "<");
-	root->pi[i][j + 1] = NULL; // null terminate pi list for this target
-	root->pi[i][j] = s; // set instruction
+// Returns the predefined entity whose name, followed by ';', starts at s, NULL
+// if there is none.
+static const struct ezxml_std *ezxml_ent_std(CONST_STRPTR s)
+{
+	int h;
+
+	if(!*s) return NULL;
+	h = (((UBYTE)s[0] + (UBYTE)s[1]) >> 2) & 7; // no two predefined names collide
+	if(!ezxml_std[h].name || strncmp(s, ezxml_std[h].name, ezxml_std[h].len)) return NULL;
+	return &ezxml_std[h];
 }
 
-// called when the parser finds an internal doctype subset
-SHORT ezxml_internal_dtd(ezxml_root_t root, STRPTR s, ULONG len, struct LibBase *MyLibBase)
+// Returns the FNV-1a hash of the l bytes at s.
+static ULONG ezxml_hash(CONST_STRPTR s, ULONG l)
 {
-	BYTE q;
-	STRPTR c, t, n = NULL, v, *ent, *pe;
-	int i, j;
+	ULONG h = 2166136261UL;
 
-	pe = memcpy(malloc(sizeof(EZXML_NIL)), EZXML_NIL, sizeof(EZXML_NIL));
+	while(l--) h = (h ^ (UBYTE) * (s++)) * 16777619UL;
+	return h;
+}
 
-	for(s[len] = '\0'; s;)
-	{
-		while(*s && *s != '<' && *s != '%') s++;  // find next declaration
+// Returns the entity of table ent whose name, followed by ';', starts at s, NULL
+// if there is none. No more than the length of the longest name is looked at.
+static struct ezxml_ent *ezxml_ent_get(struct ezxml_ents *ent, CONST_STRPTR s)
+{
+	struct ezxml_ent *e;
+	ULONG l;
 
-		if(!*s) break;
+	if(!ent->count) return NULL;
+	for(l = 1; l <= ent->max && s[l - 1]; l++)
+	{
+		if(s[l - 1] != ';') continue;  // names end with ';'
+		for(e = ent->tab[ezxml_hash(s, l) & ent->mask]; e; e = e->next)
+			if(e->len == l && !strncmp(e->name, s, l)) return e;
+	}
+	return NULL;
+}
+
+// Adds entity name, which ends with ';', with replacement text value to table
+// ent. Memory comes from the arena of document root. An entity declared before
+// keeps its first value. Returns FALSE if out of memory.
+static BOOL ezxml_ent_add(ezxml_root_t root, struct ezxml_ents *ent, STRPTR name, STRPTR value, struct LibBase *MyLibBase)
+{
+	struct ezxml_ent *e, *n, **tab;
+	ULONG i, m, l = strlen(name);
+
+	if(ent->count)    // look for an earlier declaration
+		for(e = ent->tab[ezxml_hash(name, l) & ent->mask]; e; e = e->next)
+			if(e->len == l && !strcmp(e->name, name)) return TRUE;
+
+	if(ent->count >= ent->mask)    // keep less than one entity per bucket
+	{
+		m = (ent->tab) ? 2 * ent->mask + 1 : 15;
+		if(!(tab = ezxml_alloc(root, (m + 1) * sizeof(*tab), MyLibBase))) return FALSE;
+		for(i = 0; ent->tab && i <= ent->mask; i++)
+			for(e = ent->tab[i]; e; e = n)    // rehash
+			{
+				n = e->next;
+				e->next = tab[ezxml_hash(e->name, e->len) & m];
+				tab[ezxml_hash(e->name, e->len) & m] = e;
+			}
+		ent->tab = tab;
+		ent->mask = m;
+	}
+
+	if(!(e = ezxml_alloc(root, sizeof(struct ezxml_ent), MyLibBase))) return FALSE;
+	e->name = name;
+	e->value = value;
+	e->len = l;
+	e->vlen = strlen(value);
+	e->next = ent->tab[i = ezxml_hash(name, l) & ent->mask];
+	ent->tab[i] = e;
+	if(l > ent->max) ent->max = l;
+	ent->count++;
+	return TRUE;
+}
+
+// Returns the interned name of document root equal to name, whose hash is h,
+// or NULL if no parsed tag or attribute has that name.
+static struct ezxml_sym *ezxml_sym_get(ezxml_root_t root, CONST_STRPTR name, ULONG h)
+{
+	struct ezxml_sym *y;
+
+	if(!root->sym.count) return NULL;
+	for(y = root->sym.tab[h & root->sym.mask]; y; y = y->next)
+		if(y->hash == h && !strcmp(y->name, name)) return y;
+	return NULL;
+}
+
+// Interns the null terminated name in the symbol table of document root.
+// Returns the copy of the name interned first, which is name itself for a new
+// name or if out of memory.
+static STRPTR ezxml_sym_add(ezxml_root_t root, STRPTR name, struct LibBase *MyLibBase)
+{
+	struct ezxml_syms *sym = &root->sym;
+	struct ezxml_sym *y, *n, **tab;
+	ULONG i, m, h = ezxml_hash(name, strlen(name));
+
+	if((y = ezxml_sym_get(root, name, h))) return y->name;
+
+	if(sym->count >= sym->mask)    // keep less than one name per bucket
+	{
+		m = (sym->tab) ? 2 * sym->mask + 1 : 63;
+		if(!(tab = ezxml_alloc(root, (m + 1) * sizeof(*tab), MyLibBase))) return name;
+		for(i = 0; sym->tab && i <= sym->mask; i++)
+			for(y = sym->tab[i]; y; y = n)    // rehash
+			{
+				n = y->next;
+				y->next = tab[y->hash & m];
+				tab[y->hash & m] = y;
+			}
+		sym->tab = tab;
+		sym->mask = m;
+	}
+
+	if(!(y = ezxml_alloc(root, sizeof(struct ezxml_sym), MyLibBase))) return name;
+	y->name = name;
+	y->hash = h;
+	y->next = sym->tab[h & sym->mask];
+	sym->tab[h & sym->mask] = y;
+	sym->count++;
+	return name;
+}
+
+// Returns the hash of the default attribute name of the tag named by the tlen
+// bytes at tag, of the tag itself if name is NULL.
+static ULONG ezxml_def_hash(CONST_STRPTR tag, ULONG tlen, CONST_STRPTR name)
+{
+	ULONG h = ezxml_hash(tag, tlen);
+
+	return (name) ? h * 31 + ezxml_hash(name, strlen(name)) : h;
+}
+
+// Works like ezxml_def_get() for the tag named by the tlen bytes at tag, which
+// need not be null terminated.
+static struct ezxml_def *ezxml_def_getn(ezxml_root_t root, CONST_STRPTR tag, ULONG tlen, CONST_STRPTR name)
+{
+	struct ezxml_def *y;
+	ULONG h;
+
+	if(!root->def.count) return NULL;
+	h = ezxml_def_hash(tag, tlen, name);
+	for(y = root->def.tab[h & root->def.mask]; y; y = y->next)
+		if(y->hash == h && !strncmp(y->tag, tag, tlen) && !y->tag[tlen] && ((!name) ? !y->name
+		        : y->name && !strcmp(y->name, name))) return y;
+	return NULL;
+}
+
+// Returns the default attribute name of tag declared in the DTD of document
+// root, the entry of the tag itself if name is NULL, or NULL if not declared.
+static struct ezxml_def *ezxml_def_get(ezxml_root_t root, CONST_STRPTR tag, CONST_STRPTR name)
+{
+	return ezxml_def_getn(root, tag, strlen(tag), name);
+}
+
+// Adds an entry for the default attribute name of tag, or for the tag itself if
+// name is NULL, to the table of document root. The caller fills in the rest.
+// Returns NULL if out of memory.
+static struct ezxml_def *ezxml_def_add(ezxml_root_t root, STRPTR tag, STRPTR name, struct LibBase *MyLibBase)
+{
+	struct ezxml_defs *def = &root->def;
+	struct ezxml_def *y, *n, **tab;
+	ULONG i, m;
+
+	if(def->count >= def->mask)    // keep less than one entry per bucket
+	{
+		m = (def->tab) ? 2 * def->mask + 1 : 15;
+		if(!(tab = ezxml_alloc(root, (m + 1) * sizeof(*tab), MyLibBase))) return NULL;
+		for(i = 0; def->tab && i <= def->mask; i++)
+			for(y = def->tab[i]; y; y = n)    // rehash
+			{
+				n = y->next;
+				y->next = tab[y->hash & m];
+				tab[y->hash & m] = y;
+			}
+		def->tab = tab;
+		def->mask = m;
+	}
+
+	if(!(y = ezxml_alloc(root, sizeof(struct ezxml_def), MyLibBase))) return NULL;
+	y->tag = tag;
+	y->name = name;
+	y->hash = ezxml_def_hash(tag, strlen(tag), name);
+	y->next = def->tab[y->hash & def->mask];
+	def->tab[y->hash & def->mask] = y;
+	def->count++;
+	return y;
+}
+
+// Builds the name index htab of tag xml, holding the first subtag of each name,
+// from the arena of the document of xml. Returns FALSE if out of memory.
+static BOOL ezxml_name_index(ezxml_t xml)
+{
+	struct ezxml_node *n = EZXML_NODE(xml);
+	struct LibBase *MyLibBase = n->doc->base;
+	ezxml_t cur, *b;
+	ULONG m;
+
+	for(m = 31; m < 2 * n->names; m = 2 * m + 1);  // at most one name per two buckets
+	if(!(n->htab = ezxml_alloc(n->doc, (m + 1) * sizeof(ezxml_t), MyLibBase))) return FALSE;
+	n->hmask = m;
+	for(cur = xml->child; cur; cur = cur->sibling)
+	{
+		b = &n->htab[ezxml_hash(cur->name, strlen(cur->name)) & m];
+		EZXML_NODE(cur)->hnext = *b;
+		*b = cur;
+	}
+	return TRUE;
+}
+
+// Returns the first subtag of xml named name, or NULL, through the name index
+// if there is one and else by searching the sibling list. Changes nothing.
+static ezxml_t ezxml_name_peek(ezxml_t xml, CONST_STRPTR name)
+{
+	struct ezxml_node *n = EZXML_NODE(xml);
+	ezxml_t cur;
+
+	if(n->htab)
+	{
+		for(cur = n->htab[ezxml_hash(name, strlen(name)) & n->hmask];
+		        cur && cur->name != name && strcmp(name, cur->name);
+		        cur = EZXML_NODE(cur)->hnext);
+		return cur;
+	}
+	for(cur = xml->child; cur && cur->name != name && strcmp(name, cur->name);
+	        cur = cur->sibling);
+	return cur;
+}
+
+// Returns the first subtag of xml named name, or NULL. Tags with more than
+// EZXML_NAMEIDX distinct subtag names get a name index on first use, the
+// others have their sibling list searched.
+static ezxml_t ezxml_name_get(ezxml_t xml, CONST_STRPTR name)
+{
+	if(EZXML_NODE(xml)->names > EZXML_NAMEIDX && !EZXML_NODE(xml)->htab) ezxml_name_index(xml);
+	return ezxml_name_peek(xml, name);
+}
+
+// Notes that subtag xml of dest is the first of a new name. An outgrown name
+// index is dropped, to be built again with more buckets when needed.
+static VOID ezxml_name_add(ezxml_t dest, ezxml_t xml)
+{
+	struct ezxml_node *n = EZXML_NODE(dest);
+	ezxml_t *b;
+
+	if(++n->names > n->hmask) n->htab = NULL;  // memory stays in the arena
+	else if(n->htab)
+	{
+		b = &n->htab[ezxml_hash(xml->name, strlen(xml->name)) & n->hmask];
+		EZXML_NODE(xml)->hnext = *b;
+		*b = xml;
+	}
+}
+
+// Replaces old, first subtag of its name in dest, by xml in the name index of
+// dest. If xml is NULL the name is gone from dest.
+static VOID ezxml_name_set(ezxml_t dest, ezxml_t old, ezxml_t xml)
+{
+	struct ezxml_node *n = EZXML_NODE(dest);
+	ezxml_t *b;
+
+	if(!xml) n->names--;
+	if(!n->htab) return;
+	for(b = &n->htab[ezxml_hash(old->name, strlen(old->name)) & n->hmask]; *b != old;
+	        b = &EZXML_NODE(*b)->hnext);
+	if(xml) EZXML_NODE(xml)->hnext = EZXML_NODE(old)->hnext;
+	*b = (xml) ? xml : EZXML_NODE(old)->hnext;
+}
+
+// Returns TRUE if xml is the first subtag of its name, which holds the count
+// and the vec of the next list.
+static BOOL ezxml_first(ezxml_t xml)
+{
+	return EZXML_NODE(xml)->vec || (xml->parent && ezxml_name_get(xml->parent, xml->name) == xml);
+}
+
+// Builds the vec of xml, the first subtag of its name, from the arena of its
+// document. Leaves vec NULL if out of memory.
+static VOID ezxml_vec_build(ezxml_t xml)
+{
+	struct ezxml_node *n = EZXML_NODE(xml);
+	struct LibBase *MyLibBase = n->doc->base;
+	ezxml_t cur;
+	ULONG i;
+
+	n->vmax = 2 * n->count;
+	if(!(n->vec = ezxml_alloc(n->doc, n->vmax * sizeof(ezxml_t), MyLibBase))) return;
+	for(cur = xml, i = 0; cur; cur = cur->next) n->vec[i++] = cur;
+}
+
+// Appends xml, just added to the end of the next list of first, to the vec of
+// first if it has one. The count is updated already. A full vec moves to twice
+// the room, or is dropped if out of memory.
+static VOID ezxml_vec_push(ezxml_t first, ezxml_t xml)
+{
+	struct ezxml_node *n = EZXML_NODE(first);
+	struct LibBase *MyLibBase = n->doc->base;
+	ezxml_t *v;
+
+	if(!n->vec) return;
+	if(n->count > n->vmax)    // full
+	{
+		if(!(v = ezxml_alloc(n->doc, 2 * n->vmax * sizeof(ezxml_t), MyLibBase)))
+		{
+			n->vec = NULL;
+			return;
+		}
+		memcpy(v, n->vec, n->vmax * sizeof(ezxml_t));
+		n->vec = v; // memory stays in the arena
+		n->vmax *= 2;
+	}
+	n->vec[n->count - 1] = xml;
+}
+
+// Recursively decodes entity and character references and normalizes new lines
+// ent is the table of declared entities, the predefined ones are always known
+// to general entity decoding. set t
+// to '&' for general entity decoding, '%' for parameter entity decoding, 'c'
+// for cdata sections, ' ' for attribute normalization, or '*' for non-cdata
+// attribute normalization. Returns s, or if the decoded string is longer than
+// s, returns a string allocated from the arena of document mem or, if mem is
+// NULL, a malloced string that must be freed.
+// Decoding is a single forward pass writing the result at w behind the read
+// position r. The replacement text of an entity is put in front of the rest of
+// the input, into the room the input decoded so far left, and read again from
+// there. Only if that room is too small everything moves to a new buffer with
+// twice the room needed.
+STRPTR ezxml_decode(STRPTR s, struct ezxml_ents *ent, BYTE t, ezxml_root_t mem, struct LibBase *MyLibBase)
+{
+	const struct ezxml_std *p;
+	struct ezxml_ent *x;
+	STRPTR e, r, w, z, n, o = s;
+	long b, c, d, l;
+
+	for(r = s; *r && *r != '\r'; r++);  // normalize line endings
+	for(w = r; *r; w++)
+	{
+		if(*r != '\r') *w = *(r++);
+		else   // "\r\n" and a single '\r' become '\n'
+		{
+			*w = '\n';
+			if(*(++r) == '\n') r++;
+		}
+	}
+	*(z = w) = '\0'; // z is the end of the input left to decode
+
+	if(t == 'c') return s;  // nothing else to do for cdata sections
+
+	for(r = w = s; ;)
+	{
+		for(e = r; *r && *r != '&' && (*r != '%' || t != '%') &&
+		        ((t != ' ' && t != '*') || !isspace(*r)); r++);
+		if(w != e) memmove(w, e, r - e);  // no decoding needed
+		w += r - e;
+
+		if(!*r) break;
+		else if(*r == '&' && r[1] == '#')    // character reference
+		{
+			if(r[2] == 'x') c = strtol(r + 3, &e, 16);  // base 16
+			else c = strtol(r + 2, &e, 10); // base 10
+			if(!c || *e != ';')
+			{
+				*(w++) = *(r++); // not a character ref
+				continue;
+			}
+			if(c >= 0x80)    // multi-byte UTF-8 sequence
+			{
+				for(b = 0, d = c; d; d /= 2) b++;  // number of bits in c
+				b = (b - 2) / 5; // number of bytes in payload
+				*(w++) = (0xFF << (7 - b)) | (c >> (6 * b)); // head
+				while(b) *(w++) = 0x80 | ((c >> (6 * --b)) & 0x3F);  // payload
+			}
+			else if((UBYTE)c != ' ' || t != '*' || (w > o && w[-1] != ' '))
+				*(w++) = c; // US-ASCII subset
+			r = e + 1;
+		}
+		else if((*r == '&' && (t == '&' || t == ' ' || t == '*')) ||
+		        (*r == '%' && t == '%'))   // entity reference
+		{
+			if(*r == '&' && (p = ezxml_ent_std(r + 1)))    // predefined entity
+			{
+				*(w++) = p->c;
+				r += p->len + 1;
+			}
+			else if(!(x = ezxml_ent_get(ent, r + 1))) *(w++) = *(r++);  // not a known entity
+			else if((c = x->vlen) <= (e = r + x->len + 1) - w)
+				memcpy(r = e - c, x->value, c); // read replacement text next
+			else   // not enough room, move to a new buffer
+			{
+				l = 2 * ((w - o) + c + (z - e) + 1);
+				if(!(n = (mem) ? ezxml_alloc(mem, l, MyLibBase) : malloc(l))) break;
+				memcpy(n, o, w - o); // decoded so far
+				r = n + l - (z - e) - 1;
+				memcpy(r, e, z - e + 1); // rest of the input goes to the end
+				memcpy(r -= c, x->value, c); // replacement text in front of it
+				w = n + (w - o);
+				z = n + l - 1;
+				if(o != s && !mem) free(o);
+				o = n;
+			}
+		}
+		else if((t == ' ' || t == '*') && isspace(*r))    // normalize white space
+		{
+			r++;
+			if(t != '*' || (w > o && w[-1] != ' ')) *(w++) = ' ';  // '*' squeezes
+		}
+		else *(w++) = *(r++); // no decoding needed
+	}
+
+	if(t == '*' && w > o && w[-1] == ' ') w--;  // trim any trailing space
+	*w = '\0';
+	return o;
+}
+
+// called when parser finds start of new tag, interns the names of the tag and
+// its attributes
+VOID ezxml_open_tag(ezxml_root_t root, STRPTR name, STRPTR *attr, struct LibBase *MyLibBase)
+{
+	ezxml_t xml = root->cur;
+	ULONG i, pos = root->off + (name - 1 - root->s); // offset of the '<'
+
+	name = ezxml_sym_add(root, name, MyLibBase); // names are all terminated by now
+	for(i = 0; attr[i]; i += 2) attr[i] = ezxml_sym_add(root, attr[i], MyLibBase);
+	if(xml->name)
+	{
+		if(xml->flags & EZXML_TXTD) ezxml_txt(xml);  // off counts decoded text
+		xml = ezxml_add_child(xml, name, EZXML_NODE(xml)->len, MyLibBase);
+	}
+	else xml->name = name; // first open tag
+
+	xml->attr = attr;
+	EZXML_NODE(xml)->pos = pos;
+	root->cur = xml; // update tag insertion point
+}
+
+// called when parser finds character content between open and closing tag, t
+// is the ezxml_decode() mode or '\0' if the text is known to need no decoding
+VOID ezxml_char_content(ezxml_root_t root, STRPTR s, ULONG len, BYTE t, struct LibBase *MyLibBase)
+{
+	ezxml_t xml = root->cur;
+	struct ezxml_node *n = EZXML_NODE(xml);
+	struct ezxml_seg *g;
+
+	if(!xml || !xml->name || !len) return;  // sanity check
+
+	s[len] = '\0'; // null terminate text (calling functions anticipate this)
+	if(xml->flags & EZXML_TXTD) ezxml_txt(xml);  // can't append to it
+	if(t == '&' && (root->mode & EZXML_PARSE_LAZY) && !*(xml->txt))
+	{
+		xml->txt = s; // decoded by the first ezxml_txt() call
+		xml->flags |= EZXML_TXTD;
+		return;
+	}
+
+	if(t) len = strlen(s = ezxml_decode(s, &root->ent, t, root, MyLibBase));
+	if(!len) return;  // nothing left
+
+	if(!*(xml->txt))    // initial character content
+	{
+		xml->txt = s;
+		n->len = len;
+		return;
+	}
+
+	// more text, collect the parts and join them once when the tag is complete
+	if(!(g = ezxml_alloc(root, (n->seg) ? sizeof(*g) : 2 * sizeof(*g), MyLibBase))) return;
+	if(!n->seg)    // the initial text becomes the first segment
+	{
+		g->s = xml->txt;
+		g->len = n->len;
+		g->next = n->seg = g;
+		xml->flags |= EZXML_TXTS;
+		g++;
+	}
+	g->s = s;
+	g->len = len;
+	g->next = n->seg->next;
+	n->seg = n->seg->next = g;
+	n->len += len;
+}
+
+// joins the text segments of tag xml to a string in the arena of its document
+static VOID ezxml_flatten(ezxml_t xml, struct LibBase *MyLibBase)
+{
+	struct ezxml_node *n = EZXML_NODE(xml);
+	struct ezxml_seg *g = n->seg;
+	STRPTR s;
+	ULONG l = 0;
+
+	if(!(s = ezxml_alloc(n->doc, n->len + 1, MyLibBase))) return;  // cleared
+	do
+	{
+		g = g->next;
+		memcpy(s + l, g->s, g->len);
+		l += g->len;
+	}
+	while(g != n->seg);
+
+	xml->txt = s;
+	xml->flags &= ~EZXML_TXTS;
+	n->seg = NULL;
+}
+
+// joins the text of the tags still open when parsing stops, unless that is left
+// to ezxml_txt()
+static VOID ezxml_flatten_open(ezxml_root_t root, struct LibBase *MyLibBase)
+{
+	ezxml_t xml;
+
+	if(root->mode & EZXML_PARSE_LAZY) return;
+	for(xml = root->cur; xml; xml = xml->parent)
+		if(xml->flags & EZXML_TXTS) ezxml_flatten(xml, MyLibBase);
+}
+
+// called when parser finds closing tag
+ezxml_t ezxml_close_tag(ezxml_root_t root, STRPTR name, STRPTR s, struct LibBase *MyLibBase)
+{
+	if(!root->cur || !root->cur->name || strcmp(name, root->cur->name))
+		return ezxml_err(root, s, "unexpected closing tag </%s>", name);
+
+	if((root->cur->flags & EZXML_TXTS) && !(root->mode & EZXML_PARSE_LAZY))
+		ezxml_flatten(root->cur, MyLibBase); // text is complete, callers read txt directly
+	EZXML_NODE(root->cur)->slen = root->off + (s - root->s) + 1 - EZXML_NODE(root->cur)->pos;
+	root->cur = root->cur->parent;
+	return NULL;
+}
+
+// checks for circular entity references, returns non-zero if no circular
+// references are found, zero otherwise. r is the character references to
+// entities of table ent start with, '&' or '%'.
+ULONG ezxml_ent_ok(STRPTR name, STRPTR s, struct ezxml_ents *ent, BYTE r)
+{
+	struct ezxml_ent *e;
+
+	for(; ; s++)
+	{
+		while(*s && *s != r) s++;  // find next entity reference
+		if(!*s) return 1;
+		if(!strncmp(s + 1, name, strlen(name))) return 0;  // circular ref.
+		if((e = ezxml_ent_get(ent, s + 1)) && !ezxml_ent_ok(name, e->value, ent, r)) return 0;
+	}
+}
+
+// returns the end of the processing instruction following "<?" at s, NULL if
+// it is unclosed
+static STRPTR ezxml_pi_end(STRPTR s)
+{
+	do
+	{
+		s = strchr(s, '?');
+	}
+	while(s && *(++s) && *s != '>');
+	return s;
+}
+
+// null terminates the processing instruction of len bytes at s and its target,
+// returns the instruction following the target
+static STRPTR ezxml_pi_split(STRPTR s, ULONG len)
+{
+	s[len] = '\0'; // null terminate instruction
+	if(*(s += strcspn(s, EZXML_WS)))
+	{
+		*s = '\0'; // null terminate target
+		s += strspn(s + 1, EZXML_WS) + 1; // skip whitespace after target
+	}
+	return s;
+}
+
+// handles <?xml ... ?>, returns non-zero if target is "xml"
+static ULONG ezxml_xml_decl(ezxml_root_t root, STRPTR target, STRPTR s)
+{
+	if(strcmp(target, "xml")) return FALSE;
+	if((s = strstr(s, "standalone")) && !strncmp(s + strspn(s + 10,
+	        EZXML_WS "='\"") + 10, "yes", 3)) root->standalone = 1;
+	return TRUE;
+}
+
+// returns the end of the doctype declaration following "<!DOCTYPE" at s, sets
+// *sub if it has an internal subset
+static STRPTR ezxml_dtd_end(STRPTR s, LONG *sub)
+{
+	LONG l;
+
+	for(l = 0; *s && ((!l && *s != '>') || (l && (*s != ']' ||
+	                  *(s + strspn(s + 1, EZXML_WS) + 1) != '>')));
+	        l = (*s == '[') ? 1 : l) s += strcspn(s + 1, "[]>") + 1;
+	*sub = l;
+	return s;
+}
+
+// called when the parser finds a processing instruction
+VOID ezxml_proc_inst(ezxml_root_t root, STRPTR s, ULONG len, struct LibBase *MyLibBase)
+{
+	int i = 0, j = 1;
+	char *target = s;
+
+	s = ezxml_pi_split(s, len);
+	if(ezxml_xml_decl(root, target, s)) return;
+
+	if(!root->pi[0]) *(root->pi = malloc(sizeof(char **))) = NULL;  //first pi
+
+	while(root->pi[i] && strcmp(target, root->pi[i][0])) i++;  // find target
+	if(!root->pi[i])    // new target
+	{
+		root->pi = realloc(root->pi, sizeof(char **) * (i + 2));
+		root->pi[i] = malloc(sizeof(char *) * 3);
+		root->pi[i][0] = target;
+		root->pi[i][1] = (char *)(root->pi[i + 1] = NULL); // terminate pi list
+		root->pi[i][2] = strdup(""); // empty document position list
+	}
+
+	while(root->pi[i][j]) j++;  // find end of instruction list for this target
+	root->pi[i] = realloc(root->pi[i], sizeof(char *) * (j + 3));
+	root->pi[i][j + 2] = realloc(root->pi[i][j + 1], j + 1);
+	strcpy(root->pi[i][j + 2] + j - 1, (root->xml.name) ? ">" : "<");
+	root->pi[i][j + 1] = NULL; // null terminate pi list for this target
+	root->pi[i][j] = s; // set instruction
+}
+
+// called when the parser finds an internal doctype subset
+SHORT ezxml_internal_dtd(ezxml_root_t root, STRPTR s, ULONG len, struct LibBase *MyLibBase)
+{
+	BYTE q;
+	STRPTR c, t, n = NULL, v;
+	struct ezxml_ents pe = { NULL, 0, 0, 0 }, *ent; // parameter entities
+	struct ezxml_def *d;
+	int i, j;
+
+	for(s[len] = '\0'; s;)
+	{
+		while(*s && *s != '<' && *s != '%') s++;  // find next declaration
+
+		if(!*s) break;
 		else if(!strncmp(s, "<!ENTITY", 8))    // parse entity definitions
 		{
 			c = s += strspn(s + 8, EZXML_WS) + 8; // skip white space separator
@@ -693,22 +2099,21 @@ SHORT ezxml_internal_dtd(ezxml_root_t root, STRPTR s, ULONG len, struct LibBase
 				continue;
 			}
 
-			for(i = 0, ent = (*c == '%') ? pe : root->ent; ent[i]; i++);
-			ent = realloc(ent, (i + 3) * sizeof(char *)); // space for next ent
-			if(*c == '%') pe = ent;
-			else root->ent = ent;
-
+			ent = (*c == '%') ? &pe : &root->ent;
 			*(++s) = '\0'; // null terminate name
 			if((s = strchr(v, q))) * (s++) = '\0'; // null terminate value
-			ent[i + 1] = ezxml_decode(v, pe, '%', MyLibBase); // set value
-			ent[i + 2] = NULL; // null terminate entity list
-			if(!ezxml_ent_ok(n, ent[i + 1], ent))    // circular reference
+			t = ezxml_decode(v, &pe, '%', root, MyLibBase); // value
+			if(!ezxml_ent_ok(n, t, ent, (*c == '%') ? '%' : '&'))    // circular reference
+			{
+				ezxml_err(root, v, "circular entity declaration %c%s", (*c == '%') ? '%' : '&', n);
+				break;
+			}
+			if(*c != '%' && ezxml_ent_std(n)) continue;  // predefined, can't change
+			if(!ezxml_ent_add(root, ent, n, t, MyLibBase))
 			{
-				if(ent[i + 1] != v) free(ent[i + 1]);
-				ezxml_err(root, v, "circular entity declaration &%s", n);
+				ezxml_err(root, v, "out of memory");
 				break;
 			}
-			else ent[i] = n; // set entity name
 		}
 		else if(!strncmp(s, "<!ATTLIST", 9))    // parse default attributes
 		{
@@ -720,7 +2125,8 @@ SHORT ezxml_internal_dtd(ezxml_root_t root, STRPTR s, ULONG len, struct LibBase
 			}
 			if(*(s = t + strcspn(t, EZXML_WS ">")) == '>') continue;
 			else *s = '\0'; // null terminate tag name
-			for(i = 0; root->attr[i] && strcmp(n, root->attr[i][0]); i++);
+			if((d = ezxml_def_get(root, t, NULL))) i = d->i;  // tag declared before
+			else for(i = 0; root->attr[i]; i++);  // new tag goes to the end
 
 			while(*(n = ++s + strspn(s, EZXML_WS)) && *n != '>')
 			{
@@ -761,6 +2167,12 @@ SHORT ezxml_internal_dtd(ezxml_root_t root, STRPTR s, ULONG len, struct LibBase
 
 				if(!root->attr[i])    // new tag name
 				{
+					if(!(d = ezxml_def_add(root, t, NULL, MyLibBase)))
+					{
+						ezxml_err(root, t, "out of memory");
+						break;
+					}
+					d->i = i;
 					root->attr = (!i) ? malloc(2 * sizeof(char **))
 					             : realloc(root->attr,
 					                       (i + 2) * sizeof(char **));
@@ -775,11 +2187,20 @@ SHORT ezxml_internal_dtd(ezxml_root_t root, STRPTR s, ULONG len, struct LibBase
 
 				root->attr[i][j + 3] = NULL; // null terminate list
 				root->attr[i][j + 2] = c; // is it cdata?
-				root->attr[i][j + 1] = (v) ? ezxml_decode(v, root->ent, *c, MyLibBase)
+				root->attr[i][j + 1] = (v) ? ezxml_decode(v, &root->ent, *c, NULL, MyLibBase)
 				                       : NULL;
 				root->attr[i][j] = n; // attribute name
-			}
-		}
+
+				if(ezxml_def_get(root, t, n)) continue;  // first declaration binds
+				if(!(d = ezxml_def_add(root, t, n, MyLibBase)))
+				{
+					ezxml_err(root, t, "out of memory");
+					break;
+				}
+				d->value = root->attr[i][j + 1];
+				d->mode = c;
+			}
+		}
 		else if(!strncmp(s, "<!--", 4)) s = strstr(s + 4, "-->");  // comments
 		else if(!strncmp(s, "<?", 2))    // processing instructions
 		{
@@ -790,7 +2211,6 @@ SHORT ezxml_internal_dtd(ezxml_root_t root, STRPTR s, ULONG len, struct LibBase
 		else if(*(s++) == '%' && !root->standalone) break;
 	}
 
-	free(pe);
 	return !*root->err;
 }
 
@@ -830,27 +2250,316 @@ STRPTR ezxml_str2utf8(STRPTR *s, ULONG *len, struct LibBase *MyLibBase)
 	return *s = realloc(u, *len = l);
 }
 
-// frees a tag attribute list
+// returns non-zero if s points into the xml data rather than to a string
+// allocated while decoding it
+static ULONG ezxml_in_src(ezxml_root_t root, STRPTR s)
+{
+	struct ezxml_block *b;
+
+	if(!root->blk) return (s >= root->s && s <= root->e);
+	for(b = root->blk; b; b = b->next)
+		if(s >= b->data && s <= b->data + b->size) return 1;
+	return 0;
+}
+
+// frees the values of a list made by ezxml_scan_attr() which were malloced
+// while decoding
+static VOID ezxml_free_vals(ezxml_root_t root, STRPTR *attr)
+{
+	int i;
+
+	for(i = 1; attr[i - 1]; i += 2)    // only grown values are not in the document
+		if(*attr[i] && !ezxml_in_src(root, attr[i])) free(attr[i]);
+}
+
+// frees the malloced names and values of a tag attribute list, the list itself
+// is released with the arena of its document
 VOID ezxml_free_attr(STRPTR *attr, struct LibBase *MyLibBase)
 {
 	int i = 0;
 	char *m;
 
-	if(!attr || attr == EZXML_NIL || attr[0] == NULL) return;  // nothing to free
+	if(!attr || attr[0] == NULL) return;  // nothing to free
 	while(attr[i]) i += 2;  // find end of attribute list
 	m = attr[i + 1]; // list of which names and values are malloced
-	if(m)
+	for(i = 0; m[i]; i++)
+	{
+		if((m[i] & EZXML_NAMEM) && attr[i * 2]) free(attr[i * 2]);
+		if((m[i] & EZXML_TXTM) && attr[(i * 2) + 1]) free(attr[(i * 2) + 1]);
+	}
+}
+
+// compares the start of s with keyword k, returns 1 if s starts with k, -1 if s
+// ends somewhere inside of k and 0 otherwise
+static LONG ezxml_kw(STRPTR s, CONST_STRPTR k)
+{
+	for(; *k; s++, k++) if(*s != *k) return (*s) ? 0 : -1;
+	return 1;
+}
+
+// returns non-zero if the markup following the '<' at s is not cut off by the
+// null terminator, so ezxml_parse_run() can parse it as a whole. hint is the
+// number of bytes of it already known to be cut off.
+static ULONG ezxml_markup_done(STRPTR s, ULONG hint)
+{
+	STRPTR t;
+	LONG l;
+	BYTE q;
+
+	if(!*s) return 0;
+	else if(*s == '!')
+	{
+		if((l = ezxml_kw(s, "!--")))    // xml comment
+			return (l > 0 && (t = strstr(s + ((hint > 6) ? hint - 3 : 3), "--")) && t[2]);
+		if((l = ezxml_kw(s, "![CDATA[")))    // cdata
+			return (l > 0 && strstr(s + ((hint > 11) ? hint - 3 : 8), "]]>"));
+		if((l = ezxml_kw(s, "!DOCTYPE")) < 0) return 0;
+		if(!l) return 1; // unknown declaration, an error anyway
+		return *ezxml_dtd_end(s, &l);
+	}
+	else if(*s == '?')    // processing instruction
+	{
+		s = ezxml_pi_end((hint > 2) ? s + hint - 2 : s);
+		return (s && *s);
+	}
+
+	for(; *s && *s != '>'; s++)    // tags, step over quoted attribute values
+	{
+		if(*s == '"' || *s == '\'')
+			for(q = *(s++); *s != q; s++) if(!*s) return 0;
+	}
+	return *s;
+}
+
+// makes room for n entries in the list *buf of *max entries, returns FALSE if
+// out of memory
+static ULONG ezxml_room(STRPTR **buf, ULONG *max, ULONG n, struct LibBase *MyLibBase)
+{
+	STRPTR *b;
+	ULONG m;
+
+	if(n <= *max) return TRUE;
+	for(m = (*max) ? *max : EZXML_NAMES; m < n; m *= 2);
+	if(!(b = (*buf) ? realloc(*buf, m * sizeof(STRPTR)) : malloc(m * sizeof(STRPTR))))
+		return FALSE;
+	*buf = b;
+	*max = m;
+	return TRUE;
+}
+
+// Splits the attributes following the tag name d at *s into the scratch list
+// *buf of *max entries as { name, value, name, value, ... NULL }, growing it
+// if needed. Values are null terminated and decoded if needed. Decoding is
+// done in place unless the value grows, such values don't point into the
+// document. They are allocated from the arena of document mem or, if mem is
+// NULL, malloced. On return *s points at the end of the attributes. Returns
+// the number of list entries used or -1 with an error set. When parsing lazily
+// into document mem, values are left as they are and mem->tmpf tells which of
+// them have to be decoded.
+static LONG ezxml_scan_attr(ezxml_root_t root, STRPTR d, STRPTR *s, STRPTR **buf,
+                            ULONG *max, ezxml_root_t mem, struct LibBase *MyLibBase)
+{
+	STRPTR t = *s, *b;
+	struct ezxml_def *a;
+	LONG l;
+	BYTE q, c;
+	UBYTE f, *p, lazy = mem && (mem->mode & EZXML_PARSE_LAZY);
+
+	if(!ezxml_room(buf, max, 1, MyLibBase))    // terminator
+	{
+		ezxml_err(root, d, "out of memory");
+		return -1;
+	}
+	b = *buf;
+
+
+	for(l = 0; *t && *t != '/' && *t != '>'; l += 2)    // new attrib
+	{
+		if(ezxml_room(buf, max, l + 3, MyLibBase) && lazy && l / 2 >= mem->fmax &&
+		        (p = (mem->tmpf) ? realloc(mem->tmpf, *max / 2) : malloc(*max / 2)))
+		{
+			mem->tmpf = p; // flags for as many values as the list has room for
+			mem->fmax = *max / 2;
+		}
+		if(l + 3 > *max || (lazy && l / 2 >= mem->fmax))    // out of memory
+		{
+			b[l] = NULL;
+			if(!mem) ezxml_free_vals(root, b);
+			ezxml_err(root, d, "out of memory");
+			return -1;
+		}
+		b = *buf;
+		if(lazy) mem->tmpf[l / 2] = 0;
+		b[l + 1] = ""; // no value
+		b[l] = t; // set attribute name
+
+		t = ezxml_find(t, EZXML_C_WS | EZXML_C_EQ | EZXML_C_SL | EZXML_C_GT);
+		if(EZXML_CC(*t) & (EZXML_C_EQ | EZXML_C_WS))
+		{
+			*(t++) = '\0'; // null terminate tag attribute name
+			q = *(t = ezxml_skip(t, EZXML_C_WS | EZXML_C_EQ));
+			if(q == '"' || q == '\'')    // attribute value
+			{
+				b[l + 1] = ++t;
+				f = 0;
+				t = ezxml_scan(t, root->e, q, EZXML_C_ADEC, &f);
+				if(!*t)
+				{
+					b[l] = NULL;
+					if(!mem) ezxml_free_vals(root, b);
+					ezxml_err(root, d, "missing %c", q);
+					return -1;
+				}
+				*(t++) = '\0';  // null terminate attribute val
+
+				a = ezxml_def_get(root, d, b[l]);
+				c = (a) ? *a->mode : ' '; // decoding mode
+				if(lazy && (f || c == '*'))    // decode on first access
+					mem->tmpf[l / 2] = (c == '*') ? EZXML_TXTD | EZXML_TXTN : EZXML_TXTD;
+				else if(f || c == '*')
+					b[l + 1] = ezxml_decode(b[l + 1], &root->ent, c, mem, MyLibBase);
+			}
+		}
+		t = ezxml_skip(t, EZXML_C_SP);
+	}
+
+	b[l] = NULL;
+	*s = t;
+	return l;
+}
+
+// Parses markup and character content starting at the '<' at s up to the null
+// terminator. The '<' itself may already be overwritten. e is the character the
+// terminator replaced, or '\0' if nothing was. If cut is not NULL, the data is
+// followed by more input later: parsing stops in front of any markup the
+// terminator cuts off, setting *cut, and at character content not followed by
+// a tag. hint is the number of bytes of the first markup known to be cut off
+// already. On return *end points at the first byte not parsed. Returns NULL on
+// success or the root tag with an error set.
+static ezxml_t ezxml_parse_run(ezxml_root_t root, STRPTR s, BYTE e, STRPTR *end,
+                               ULONG *cut, ULONG hint, struct LibBase *MyLibBase)
+{
+	BYTE q;
+	UBYTE f;
+	STRPTR d = s, t, *attr;
+	LONG l, i;
+
+	if(cut) *cut = FALSE;
+	for(; ;)
 	{
-		for(i = 0; m[i]; i++)
+		if(cut && !ezxml_markup_done(s + 1, hint))    // cut off by end of data
+		{
+			*cut = TRUE;
+			*end = s;
+			return NULL;
+		}
+
+		hint = 0;
+		attr = (char **)EZXML_NIL;
+		d = ++s;
+
+		if(isalpha(*s) || *s == '_' || *s == ':' || *s < '\0')    // new tag
+		{
+			if(!root->cur)
+				return ezxml_err(root, d, "markup outside of root element");
+
+			s = ezxml_find(s, EZXML_C_WS | EZXML_C_SL | EZXML_C_GT);
+			while(EZXML_CC(*s) & EZXML_C_SP) *(s++) = '\0';  // null terminate tag name
+
+			// collect the attributes in the scratch list, then copy them with
+			// the list of malloced names/vals to the arena in one go
+			if((l = ezxml_scan_attr(root, d, &s, &root->tmp, &root->tmax, root,
+			                        MyLibBase)) < 0) return &root->xml;
+			if(l)
+			{
+				attr = ezxml_alloc(root, (l + 2) * sizeof(char *) + (l / 2) + 1,
+				                   MyLibBase); // cleared
+				memcpy(attr, root->tmp, (l + 1) * sizeof(char *));
+				attr[l + 1] = memset((char *)(attr + l + 2), ' ', l / 2);
+				if(root->mode & EZXML_PARSE_LAZY)    // values to decode later
+					for(i = 0; i < l / 2; i++) attr[l + 1][i] |= root->tmpf[i];
+			}
+
+			if(*s == '/')    // self closing tag
+			{
+				*(s++) = '\0';
+				if((*s && *s != '>') || (!*s && e != '>'))
+					return ezxml_err(root, d, "missing >");
+				ezxml_open_tag(root, d, attr, MyLibBase);
+				ezxml_close_tag(root, d, s, MyLibBase);
+			}
+			else if((q = *s) == '>' || (!*s && e == '>'))    // open tag
+			{
+				*s = '\0'; // temporarily null terminate tag name
+				ezxml_open_tag(root, d, attr, MyLibBase);
+				*s = q;
+			}
+			else return ezxml_err(root, d, "missing >");
+		}
+		else if(*s == '/')    // close tag
+		{
+			s = ezxml_find(d = s + 1, EZXML_C_WS | EZXML_C_GT);
+			if(!(q = *s) && e != '>') return ezxml_err(root, d, "missing >");
+			*s = '\0'; // temporarily null terminate tag name
+			t = (EZXML_CC(q) & EZXML_C_SP) ? ezxml_skip(s + 1, EZXML_C_WS) : s; // at '>'
+			if(ezxml_close_tag(root, d, t, MyLibBase)) return &root->xml;
+			*s = q;
+			s = t;
+		}
+		else if(!strncmp(s, "!--", 3))    // xml comment
+		{
+			if(!(s = strstr(s + 3, "--")) || (*(s += 2) != '>' && *s) ||
+			        (!*s && e != '>')) return ezxml_err(root, d, "unclosed <!--");
+		}
+		else if(!strncmp(s, "![CDATA[", 8))    // cdata
+		{
+			if((s = strstr(s, "]]>")))
+				ezxml_char_content(root, d + 8, (s += 2) - d - 10, 'c', MyLibBase);
+			else return ezxml_err(root, d, "unclosed <![CDATA[");
+		}
+		else if(!strncmp(s, "!DOCTYPE", 8))    // dtd
+		{
+			s = ezxml_dtd_end(s, &l);
+			if(!*s && e != '>')
+				return ezxml_err(root, d, "unclosed <!DOCTYPE");
+			d = (l) ? strchr(d, '[') + 1 : d;
+			if(l && !ezxml_internal_dtd(root, d, s++ - d, MyLibBase)) return &root->xml;
+		}
+		else if(*s == '?')    // <?...?> processing instructions
+		{
+			s = ezxml_pi_end(s);
+			if(!s || (!*s && e != '>'))
+				return ezxml_err(root, d, (STRPTR)"unclosed <?");
+			else ezxml_proc_inst(root, d + 1, s - d - 2, MyLibBase);
+		}
+		else return ezxml_err(root, d, "unexpected <");
+
+		if(!s || !*s) break;
+		*s = '\0';
+		d = ++s;
+		if(*s && *s != '<')    // tag character content
 		{
-			if((m[i] & EZXML_NAMEM) || (m[i] & EZXML_TXTM) && m[i]);
-			if((m[i] & EZXML_NAMEM) && attr[i * 2]) free(attr[i * 2]);
-			if((m[i] & EZXML_TXTM) && attr[(i * 2) + 1]) free(attr[(i * 2) + 1]);
+			f = 0;
+			s = ezxml_scan(s, root->e, '<', EZXML_C_DEC, &f);
+			if(*s) ezxml_char_content(root, d, s - d, (f) ? '&' : '\0', MyLibBase);
+			else break;
 		}
-		free(m);
+		else if(!*s) break;
 	}
-	if(attr) free(attr);
+
+	*end = d;
+	return NULL;
+}
+
+// checks that the document is complete after its last token, d is the
+// position used for error reporting
+static ezxml_t ezxml_parse_end(ezxml_root_t root, STRPTR d)
+{
+	if(!root->cur) return &root->xml;
+	else if(!root->cur->name) return ezxml_err(root, d, "root tag missing");
+	else return ezxml_err(root, d, "unclosed tag <%s>", root->cur->name);
 }
+
 //+ ezxml.library/ezxml_parse_str
 /****** ezxml.library/ezxml_parse_str *****************************************
 * NAME
@@ -861,617 +2570,2439 @@ VOID ezxml_free_attr(STRPTR *attr, struct LibBase *MyLibBase)
 *  ezxml_t ezxml_parse_str(STRPTR, ULONG);
 *
 * FUNCTION
-*  Given a string of xml data and its length, parses it and creates an ezxml
-*  structure. For efficiency, modifies the data by adding null terminators
-*  and decoding ampersand sequences. If you don't want this, copy the data and
-*  pass in the copy.
+*  Given a string of xml data and its length, parses it and creates an ezxml
+*  structure. For efficiency, modifies the data by adding null terminators
+*  and decoding ampersand sequences. If you don't want this, copy the data and
+*  pass in the copy.
+*
+* INPUTS
+*  string - pointer to string with xml data
+*  size   - size of string without 0x00 char
+*
+* RESULT
+*	Returns ezxml_t structure or NULL on failure.
+*
+* NOTES
+*  Notice that original data will be modified.
+*  Don't forget to free allocated memory with ezxml_free()
+*
+* SEE ALSO
+*  ezxml_parse_fd() ezxml_parse_file() ezxml_parse_str_flags() ezxml_free()
+********************************************************************************
+*
+*/
+//-
+ezxml_t ezxml_parse_str(STRPTR s, ULONG len, struct LibBase *MyLibBase)
+{
+	return ezxml_parse_str_flags(s, len, 0, MyLibBase);
+}
+
+//+ ezxml.library/ezxml_parse_str_flags
+/****** ezxml.library/ezxml_parse_str_flags ***********************************
+* NAME
+*  ezxml_parse_str_flags - parses string in the given mode (V9)
+*
+* SYNOPSIS
+*  ezxml_parse_str_flags(string, size, flags);
+*  ezxml_t ezxml_parse_str_flags(STRPTR, ULONG, ULONG);
+*
+* FUNCTION
+*  Works like ezxml_parse_str(), flags select how the document is parsed:
+*
+*  EZXML_PARSE_LAZY - character content and attribute values are not decoded
+*  while parsing. ezxml_txt() and ezxml_attr() decode a value the first time
+*  it is asked for and keep the result. Parsing documents of which only a few
+*  values are read gets cheaper.
+*
+*  EZXML_PARSE_LINES - accepted for compatibility, line breaks are always
+*  indexed before the data is modified.
+*
+* INPUTS
+*  string - pointer to string with xml data
+*  size   - size of string without 0x00 char
+*  flags  - EZXML_PARSE_* flags or 0
+*
+* RESULT
+*	Returns ezxml_t structure or NULL on failure.
+*
+* NOTES
+*  Notice that original data will be modified, with EZXML_PARSE_LAZY also
+*  after parsing, as values get decoded.
+*  With EZXML_PARSE_LAZY read text and attribute values only with ezxml_txt()
+*  and ezxml_attr(), the txt and attr fields of a tag may hold them raw.
+*  Text mixed with child tags is still decoded while parsing.
+*
+* SEE ALSO
+*  ezxml_parse_str() ezxml_txt() ezxml_attr() ezxml_free()
+********************************************************************************
+*
+*/
+//-
+ezxml_t ezxml_parse_str_flags(STRPTR s, ULONG len, ULONG flags, struct LibBase *MyLibBase)
+{
+	ezxml_root_t root = (ezxml_root_t)ezxml_new(NULL, MyLibBase);
+	ezxml_t err;
+	BYTE e;
+	UBYTE f = 0;
+
+	root->m = s;
+	root->mode = flags;
+	if(!len) return ezxml_err(root, NULL, "root tag missing");
+	root->u = ezxml_str2utf8(&s, &len, MyLibBase); // convert utf-16 to utf-8
+	root->e = (root->s = s) + len; // record start and end of work area
+	if(!ezxml_lines_to(root, root->e)) return ezxml_err(root, NULL, "out of memory");
+
+	e = s[len - 1]; // save end char
+	s[len - 1] = '\0'; // turn end char into null terminator
+
+	s = ezxml_scan(s, root->e, '<', EZXML_C_DEC, &f); // find first tag
+	if(!*s) return ezxml_err(root, s, "root tag missing");
+
+	err = ezxml_parse_run(root, s, e, &s, NULL, 0, MyLibBase);
+	ezxml_flatten_open(root, MyLibBase);
+	return (err) ? err : ezxml_parse_end(root, s);
+}
+
+//+ ezxml.library/ezxml_parse_fp
+/****** ezxml.library/ezxml_parse_fp ************************************************
+* NAME
+*  ezxml_parse_fp() - wrapper for ezxml_parse_str() that accepts a stream (V8)
+*
+* SYNOPSIS
+*  ezxml_parse_fp(fp);
+*  ezxml_t ezxml_parse_fp(BPTR);
+*
+* FUNCTION
+*  Reads a file handle up to its end and parses read data with
+*  ezxml_parse_str(). Works with pipes and other handles of unknown size.
+*
+* INPUTS
+*  fp - file handle returned by dos.library/Open()
+*
+* RESULT
+*	Returns ezxml_t structure or NULL on failure.
+*
+* NOTES
+*  Don't forget to free allocated memory with ezxml_free()
+*  The buffer starts at 64 KB and doubles as it fills, so each byte is copied
+*  about once more however long the stream. Much unused room is given back
+*  once the stream ends. For files, ezxml_parse_file() or ezxml_parse_fd()
+*  read all of it at once. If reading fails, ezxml_error() reports a read
+*  error and the tree holds what was read up to there.
+*
+* SEE ALSO
+*  ezxml_parse_str() ezxml_parse_fd() ezxml_free()
+**************************************************************************************
+*
+*/
+//-
+ezxml_t ezxml_parse_fp(BPTR fp, struct LibBase *MyLibBase)
+{
+	ezxml_root_t root;
+	ULONG len = 0, max = EZXML_READSIZE;
+	LONG l, err;
+	STRPTR s, t;
+
+	if(fp == NULL || !(s = AllocVec(max, MEMF_ANY))) return NULL;
+
+	SetIoErr(0);    // FRead() sets it only on failure
+	while((l = FRead(fp, s + len, 1, max - len)) > 0)
+	{
+		if((len += l) < max) continue;
+		if(!(t = AllocVec(max * 2, MEMF_ANY)))    // full, double the buffer
+		{
+			FreeVec(s);
+			return NULL;
+		}
+		CopyMem(s, t, len);
+		FreeVec(s);
+		s = t;
+		max *= 2;
+	}
+	err = IoErr();    // end of file or failure
+
+	if(max - len > len / 8 && (t = AllocVec(len + 1, MEMF_ANY)))    // give back the room left
+	{
+		CopyMem(s, t, len);
+		FreeVec(s);
+		s = t;
+	}
+	if(!(root = (ezxml_root_t)ezxml_parse_str(s, len, MyLibBase)))
+	{
+		FreeVec(s);
+		return NULL;
+	}
+	root->len = -1; // so we know to free s in ezxml_free()
+	if(err) ezxml_err(root, NULL, "read error");  // the tree holds only a part
+	return &root->xml;
+}
+
+//+ ezxml.library/ezxml_parse_fd
+/****** ezxml.library/ezxml_parse_fd ************************************************
+* NAME
+*  ezxml_parse_fd() - wrapper for ezxml_parse_str() that accepts a file handle (V8)
+*
+* SYNOPSIS
+*  ezxml_parse_fd(fd);
+*  ezxml_t ezxml_parse_fd(BPTR);
+*
+* FUNCTION
+*  Reads a file handle and parses read data with ezxml_parse_str(). Handles
+*  of unknown size, like pipes, are read by ezxml_parse_fp().
+*
+* INPUTS
+*  fd - file handle returned by dos.library/Open()
+*
+* RESULT
+*	Returns ezxml_t structure or NULL on failure.
+*
+* NOTES
+*  Don't forget to free allocated memory with ezxml_free()
+*  The file is read with as few calls as the handler allows into a buffer which
+*  is not cleared first. If reading fails, ezxml_error() reports a read error.
+*
+* SEE ALSO
+*  ezxml_parse_str() ezxml_parse_file() ezxml_parse_fp() ezxml_free()
+**************************************************************************************
+*
+*/
+//-
+ezxml_t ezxml_parse_fd(BPTR fd, struct LibBase *MyLibBase)
+{
+	ezxml_root_t root;
+	struct FileInfoBlock st;
+	LONG l, n = 0;
+	STRPTR m;
+
+	if(fd == NULL) return NULL;
+	if(!ExamineFH(fd, &st) || st.fib_Size <= 0) return ezxml_parse_fp(fd, MyLibBase);  // no size
+
+	// every byte gets read over, so the buffer is not cleared
+	if(!(m = AllocVec(st.fib_Size + 1, MEMF_ANY))) return NULL;
+	for(l = 0; l < st.fib_Size && (n = Read(fd, m + l, st.fib_Size - l)) > 0; l += n);
+	if(!(root = (ezxml_root_t)ezxml_parse_str(m, l, MyLibBase)))
+	{
+		FreeVec(m);
+		return NULL;
+	}
+	root->len = -1; // so we know to free s in ezxml_free()
+	if(n < 0) ezxml_err(root, NULL, "read error");  // the tree holds only a part
+	return &root->xml;
+}
+
+#ifndef EZXML_NOZLIB
+// Allocation functions of zlib, opaque is the library base.
+static voidpf ezxml_zalloc(voidpf opaque, uInt n, uInt size)
+{
+	struct LibBase *MyLibBase = opaque;
+
+	return AllocVec(n * size, MEMF_ANY);
+}
+
+static VOID ezxml_zfree(voidpf opaque, voidpf m)
+{
+	struct LibBase *MyLibBase = opaque;
+
+	FreeVec(m);
+}
+
+// Returns TRUE if the len bytes at b start with the gzip magic. A document
+// can't start with a control character like its first byte, while a zlib
+// header can be plain text such as "x ", so those are not looked for.
+static BOOL ezxml_zmagic(const UBYTE *b, ULONG len)
+{
+	return len >= 2 && b[0] == 0x1F && b[1] == 0x8B;
+}
+
+// Returns TRUE if the file fd holds a gzip stream, leaving fd at its start.
+// Only files of known size are looked at, as streams can't seek back.
+static BOOL ezxml_fd_z(BPTR fd, struct LibBase *MyLibBase)
+{
+	struct FileInfoBlock st;
+	UBYTE b[2];
+	LONG n;
+
+	if(!ExamineFH(fd, &st) || st.fib_Size < 2) return FALSE;
+	n = Read(fd, b, 2);
+	return Seek(fd, 0, OFFSET_BEGINNING) >= 0 && n == 2 && ezxml_zmagic(b, n);
+}
+
+// Inflates the input z holds through the window w of EZXML_ZWINDOW bytes into
+// push parser p. r is what the previous call returned, Z_OK for the first.
+// Concatenated streams are inflated one after the other. Zero bytes after a
+// stream are padding, as block devices leave it, and are skipped. Returns Z_OK
+// if more input is needed, Z_STREAM_END if a stream ended and only padding
+// followed, Z_ERRNO if the document is malformed or another zlib error.
+static int ezxml_inflate(ezxml_parser_t p, z_stream *z, UBYTE *w, int r, struct LibBase *MyLibBase)
+{
+	do
+	{
+		if(r == Z_STREAM_END)    // input follows the end of a stream
+		{
+			while(z->avail_in && !*z->next_in) z->next_in++, z->avail_in--;
+			if(!z->avail_in) break;    // padding only so far
+			if(inflateReset(z) != Z_OK) return Z_ERRNO;  // next stream
+		}
+		z->next_out = w;
+		z->avail_out = EZXML_ZWINDOW;
+		if((r = inflate(z, Z_NO_FLUSH)) == Z_BUF_ERROR) r = Z_OK; // no progress
+		if(z->avail_out < EZXML_ZWINDOW &&
+		   !ezxml_parse_chunk(p, w, EZXML_ZWINDOW - z->avail_out, MyLibBase)) return Z_ERRNO;
+	}
+	while((r == Z_OK && (z->avail_in || !z->avail_out)) || (r == Z_STREAM_END && z->avail_in));
+	return r;
+}
+
+// Parses the gzip streams read from fd. Only a window of the inflated
+// document is kept besides the tree.
+static ezxml_t ezxml_parse_z(BPTR fd, struct LibBase *MyLibBase)
+{
+	ezxml_parser_t p;
+	z_stream z;
+	UBYTE *w;
+	LONG n = 0;
+	int r = Z_OK;
+
+	if(!(p = ezxml_parser_new(MyLibBase))) return NULL;
+
+	memset(&z, 0, sizeof(z));
+	z.zalloc = ezxml_zalloc;
+	z.zfree = ezxml_zfree;
+	z.opaque = MyLibBase;
+	if(!(w = AllocVec(2 * EZXML_ZWINDOW, MEMF_ANY)) ||
+	   inflateInit2(&z, 15 + 16) != Z_OK)  // 16 expects gzip headers
+	{
+		if(w) FreeVec(w);
+		ezxml_err(p->root, NULL, "out of memory");
+		return ezxml_parse_finish(p, MyLibBase);
+	}
+
+	while((r == Z_OK || r == Z_STREAM_END) && (n = Read(fd, w + EZXML_ZWINDOW, EZXML_ZWINDOW)) > 0)
+	{
+		z.next_in = w + EZXML_ZWINDOW;
+		z.avail_in = n;
+		r = ezxml_inflate(p, &z, w, r, MyLibBase);
+	}
+
+	if(!*p->root->err && n < 0) ezxml_err(p->root, NULL, "read error");
+	else if(!*p->root->err && r != Z_STREAM_END)
+		ezxml_err(p->root, NULL, "%s", (z.msg) ? z.msg : "truncated compressed data");
+	inflateEnd(&z);
+	FreeVec(w);
+	return ezxml_parse_finish(p, MyLibBase);
+}
+#else
+#define ezxml_fd_z(fd, base) FALSE
+#define ezxml_parse_z(fd, base) NULL
+#endif // EZXML_NOZLIB
+
+//+ ezxml.library/ezxml_parse_file
+/****** ezxml.library/ezxml_parse_file *******************************************
+* NAME
+*  ezxml_parse_file() - wrapper for ezxml_parse_fd() that accepts a file name (V8)
+*
+* SYNOPSIS
+*  ezxml_parse_file(filename);
+*  ezxml_t ezxml_parse_file(CONST_STRPTR file);
+*
+* FUNCTION
+*  Opens a file with given filename and passes file pointer to ezxml_parse_fd().
+*  Files compressed with gzip are inflated while parsing, through a
+*  small window (V9).
+*
+* INPUTS
+*  filename - standard file name (as usually given for dos.library/Open())
+*
+* RESULT
+*	Returns ezxml_t structure or NULL on failure.
+*
+* NOTES
+*  Don't forget to free allocated memory with ezxml_free()
+*  Compressed documents can't be UTF-16 encoded.
+*
+* SEE ALSO
+*  ezxml_parse_str() ezxml_parse_fd() ezxml_free() ezxml_toxml_gz()
+********************************************************************************
+*
+*/
+//-
+ezxml_t ezxml_parse_file(CONST_STRPTR file, struct LibBase *MyLibBase)
+{
+	BPTR fd;
+	ezxml_t xml = NULL;
+
+	if((fd = Open(file, MODE_OLDFILE)) != NULL)
+	{
+		xml = (ezxml_fd_z(fd, MyLibBase)) ? ezxml_parse_z(fd, MyLibBase)
+		      : ezxml_parse_fd(fd, MyLibBase);
+		Close(fd);
+	}
+	return xml;
+}
+
+// Parses character content at s in push parser input. The text is added to the
+// tree only once the tag following it has arrived or, if final is set, at the
+// end of input. On return *end points at that tag, or it is s if more input is
+// needed. Returns NULL on success or the root tag with an error set.
+static ezxml_t ezxml_parse_txt(ezxml_parser_t p, STRPTR s, STRPTR *end, ULONG final,
+                               struct LibBase *MyLibBase)
+{
+	ezxml_root_t root = p->root;
+	STRPTR t;
+
+	t = ezxml_scan(s + p->hint, root->e, '<', EZXML_C_DEC, &p->f);
+	if(!*t && t != root->e) return ezxml_err(root, t, "unexpected null character");
+
+	if(*t || final)
+	{
+		ezxml_char_content(root, s, t - s, (p->f) ? '&' : '\0', MyLibBase);
+		p->hint = p->f = 0;
+		*end = t;
+	}
+	else    // text may go on in the next chunk, don't scan it again
+	{
+		p->hint = t - s;
+		*end = s;
+	}
+	return NULL;
+}
+
+// parses as much of the input buffered by a push parser as possible, returns
+// NULL on success or the root tag with an error set. If final is set, all of
+// the input is parsed and the root tag is returned.
+static ezxml_t ezxml_parse_more(ezxml_parser_t p, ULONG final, struct LibBase *MyLibBase)
+{
+	ezxml_root_t root = p->root;
+	ezxml_t err;
+	STRPTR s, t;
+
+	root->e = (root->s = s = p->blk->data + p->pos) + p->len;
+
+	while(p->cut || s < root->e)
+	{
+		if(!p->cut && *s != '<')    // character content
+		{
+			if((err = ezxml_parse_txt(p, s, &t, final, MyLibBase))) return err;
+			if(t == s || (s = t) == root->e) break;
+		}
+
+		if((err = ezxml_parse_run(root, s, '\0', &s, (final) ? NULL : &p->cut,
+		                          p->hint, MyLibBase))) return err;
+		p->hint = 0;
+		if(final || p->cut) break;
+	}
+	if(final) return ezxml_parse_end(root, s);
+
+	root->off += s - root->s;
+	p->len -= s - root->s;
+	p->pos += s - root->s;
+	if(p->cut) p->hint = p->len - 1;
+	return NULL;
+}
+
+//+ ezxml.library/ezxml_parser_new
+/****** ezxml.library/ezxml_parser_new ****************************************
+* NAME
+*  ezxml_parser_new() - creates a push parser (V9)
+*
+* SYNOPSIS
+*  ezxml_parser_new();
+*  ezxml_parser_t ezxml_parser_new(VOID);
+*
+* FUNCTION
+*  Creates a push parser context. Feed the document to it in chunks of any
+*  size with ezxml_parse_chunk() as they arrive, then call ezxml_parse_finish()
+*  to get the ezxml structure.
+*
+* RESULT
+*  Returns a parser context or NULL on failure.
+*
+* NOTES
+*  The input has to be UTF-8.
+*
+* SEE ALSO
+*  ezxml_parse_chunk() ezxml_parse_finish() ezxml_parse_str()
+********************************************************************************
+*
+*/
+//-
+ezxml_parser_t ezxml_parser_new(struct LibBase *MyLibBase)
+{
+	ezxml_parser_t p;
+
+	if(!(p = malloc(sizeof(struct ezxml_parser)))) return NULL;  // cleared
+	p->root = (ezxml_root_t)ezxml_new(NULL, MyLibBase);
+	return p;
+}
+
+//+ ezxml.library/ezxml_parse_chunk
+/****** ezxml.library/ezxml_parse_chunk ***************************************
+* NAME
+*  ezxml_parse_chunk() - parses next part of a document (V9)
+*
+* SYNOPSIS
+*  ezxml_parse_chunk(parser, buffer, size);
+*  LONG ezxml_parse_chunk(ezxml_parser_t, CONST_APTR, ULONG);
+*
+* FUNCTION
+*  Parses the next chunk of the document given to a push parser. Chunks can
+*  be split anywhere, even inside of a tag or a multi-byte character. The tree
+*  is built as far as the data received allows. Only the unfinished token at
+*  the end of a chunk is kept aside and copied once more when the next chunk
+*  arrives.
+*
+* INPUTS
+*  parser - parser context returned by ezxml_parser_new()
+*  buffer - next part of the document
+*  size   - size of the buffer
+*
+* RESULT
+*  Returns non-zero on success or zero if the document turned out to be
+*  malformed. ezxml_parse_finish() still has to be called in that case,
+*  ezxml_error() on its result tells what went wrong.
+*
+* NOTES
+*  The buffer is copied, it can be reused as soon as the call returns.
+*
+* SEE ALSO
+*  ezxml_parser_new() ezxml_parse_finish()
+********************************************************************************
+*
+*/
+//-
+LONG ezxml_parse_chunk(ezxml_parser_t p, CONST_APTR buf, ULONG len, struct LibBase *MyLibBase)
+{
+	struct ezxml_block *b;
+	ULONG size;
+
+	if(!p || *p->root->err) return FALSE;
+	if(!len) return TRUE;
+
+	if(!p->blk && (*(UBYTE *)buf == 0xFE || *(UBYTE *)buf == 0xFF))
+	{
+		ezxml_err(p->root, NULL, "UTF-16 input can't be parsed in chunks");
+		return FALSE;
+	}
+
+	if(!(b = p->blk) || p->pos + p->len + len >= b->size)    // no room left
+	{
+		size = 2 * (p->len + len);
+		if(size < EZXML_BLKSIZE) size = EZXML_BLKSIZE;
+		if(!(b = AllocVec(sizeof(struct ezxml_block) + size + 1, MEMF_ANY)))
+		{
+			ezxml_err(p->root, NULL, "out of memory");
+			return FALSE;
+		}
+
+		b->data = (STRPTR)(b + 1);
+		b->size = size;
+		if(p->len) memcpy(b->data, p->blk->data + p->pos, p->len);  // carry over
+		if(p->blk && !p->pos)    // nothing of the old block made it to the tree
+		{
+			p->root->blk = p->blk->next;
+			free(p->blk);
+		}
+
+		b->next = p->root->blk;
+		p->root->blk = p->blk = b;
+		p->pos = 0;
+	}
+
+	memcpy(b->data + p->pos + p->len, buf, len);
+	b->data[p->pos + (p->len += len)] = '\0';
+
+	p->root->e = (p->root->s = b->data + p->pos) + p->len;
+	if(!ezxml_lines_to(p->root, p->root->e))    // index lines while intact
+	{
+		ezxml_err(p->root, NULL, "out of memory");
+		return FALSE;
+	}
+	return !ezxml_parse_more(p, FALSE, MyLibBase);
+}
+
+//+ ezxml.library/ezxml_parse_finish
+/****** ezxml.library/ezxml_parse_finish **************************************
+* NAME
+*  ezxml_parse_finish() - completes parsing and disposes of a push parser (V9)
+*
+* SYNOPSIS
+*  ezxml_parse_finish(parser);
+*  ezxml_t ezxml_parse_finish(ezxml_parser_t);
+*
+* FUNCTION
+*  Parses what is left of the data given to ezxml_parse_chunk(), checks the
+*  document is complete and frees the parser context.
+*
+* INPUTS
+*  parser - parser context returned by ezxml_parser_new()
+*
+* RESULT
+*  Returns ezxml_t structure or NULL if parser is NULL.
+*
+* NOTES
+*  Don't forget to free allocated memory with ezxml_free(). Check
+*  ezxml_error() to see whether the document was well formed.
+*
+* SEE ALSO
+*  ezxml_parser_new() ezxml_parse_chunk() ezxml_free() ezxml_error()
+********************************************************************************
+*
+*/
+//-
+ezxml_t ezxml_parse_finish(ezxml_parser_t p, struct LibBase *MyLibBase)
+{
+	ezxml_root_t root;
+
+	if(!p) return NULL;
+	root = p->root;
+
+	if(!*root->err)
+	{
+		if(!p->blk) ezxml_err(root, NULL, "root tag missing");
+		else ezxml_parse_more(p, TRUE, MyLibBase);
+	}
+
+	ezxml_flatten_open(root, MyLibBase);
+	free(p);
+	return &root->xml;
+}
+
+// Entry of the process reading ahead for ezxml_parse_fd_overlap().
+static VOID ezxml_pipe_proc(struct ezxml_pipe *pl, struct LibBase *MyLibBase)
+{
+	ULONG i;
+	LONG n;
+
+	for(i = 0; ; i ^= 1)
+	{
+		Forbid();
+		while(pl->full[i] && !pl->stop) Wait(SIGBREAKF_CTRL_F);    // not parsed yet
+		Permit();
+		if(pl->stop) break;
+
+		n = Read(pl->fd, pl->data[i], EZXML_PIPESIZE);
+		Forbid();
+		pl->len[i] = n;
+		pl->full[i] = TRUE;
+		Signal(pl->owner, 1UL << pl->sig);
+		Permit();
+		if(n <= 0) break;
+	}
+
+	Forbid();    // the process is gone before the owner runs on and drops pl
+	pl->done = TRUE;
+	Signal(pl->owner, 1UL << pl->sig);
+}
+
+//+ ezxml.library/ezxml_parse_fd_overlap
+/****** ezxml.library/ezxml_parse_fd_overlap ***********************************
+* NAME
+*  ezxml_parse_fd_overlap() - parses a file handle while it is read (V9)
+*
+* SYNOPSIS
+*  ezxml_parse_fd_overlap(fd);
+*  ezxml_t ezxml_parse_fd_overlap(BPTR);
+*
+* FUNCTION
+*  Works like ezxml_parse_fd(), but a separate process reads the file in blocks
+*  of 256 KB, one block ahead, while the calling task builds the tree from the
+*  blocks read so far, like ezxml_parse_chunk(). Reading and parsing overlap
+*  instead of following each other, which pays off for slow media and large
+*  files.
+*
+* INPUTS
+*  fd - file handle returned by dos.library/Open(), also one of unknown size
+*
+* RESULT
+*	Returns ezxml_t structure or NULL on failure.
+*
+* NOTES
+*  Don't forget to free allocated memory with ezxml_free()
+*  The handle must not be used by others until the call returns. Reading stops
+*  at the first parse error. UTF-16 files are read ahead the same way, but
+*  parsed once read completely. If no process can be started, the file is
+*  parsed with ezxml_parse_fd(). If reading fails, ezxml_error() reports a
+*  read error and the tree holds what was parsed up to there.
+*
+* SEE ALSO
+*  ezxml_parse_fd() ezxml_parse_chunk() ezxml_free()
+********************************************************************************
+*
+*/
+//-
+ezxml_t ezxml_parse_fd_overlap(BPTR fd, struct LibBase *MyLibBase)
+{
+	struct ezxml_pipe pl;
+	struct Process *pr = NULL;
+	ezxml_parser_t p = NULL;
+	ezxml_root_t root;
+	STRPTR s = NULL, t;
+	ULONG i, len = 0, max = 0;
+	LONG n = 0;
+
+	if(fd == NULL) return NULL;
+	memset(&pl, 0, sizeof(pl));
+	pl.fd = fd;
+	pl.owner = FindTask(NULL);
+	if((pl.sig = AllocSignal(-1)) >= 0 && (pl.data[0] = AllocVec(2 * EZXML_PIPESIZE, MEMF_ANY)))
+	{
+		pl.data[1] = pl.data[0] + EZXML_PIPESIZE;
+		pr = CreateNewProcTags(NP_Entry, (IPTR)ezxml_pipe_proc, NP_CodeType, CODETYPE_PPC,
+		                       NP_PPC_Arg1, (IPTR)&pl, NP_PPC_Arg2, (IPTR)MyLibBase,
+		                       NP_Name, (IPTR)"ezxml reader", TAG_DONE);
+	}
+	if(!pr)    // no reading ahead
+	{
+		if(pl.sig >= 0) FreeSignal(pl.sig);
+		FreeVec(pl.data[0]);
+		return ezxml_parse_fd(fd, MyLibBase);
+	}
+	pl.reader = &pr->pr_Task;
+
+	for(i = 0; ; i ^= 1)
+	{
+		Forbid();
+		while(!pl.full[i]) Wait(1UL << pl.sig);
+		Permit();
+		if((n = pl.len[i]) <= 0) break;    // end of file or read error
+
+		if(!p && !s && (*(UBYTE *)pl.data[i] == 0xFE || *(UBYTE *)pl.data[i] == 0xFF))
+			max = EZXML_PIPESIZE;    // UTF-16, gather all of it
+		if(max)
+		{
+			if(len + n > max || !s)
+			{
+				for(; len + n > max; max *= 2);
+				if(!(t = AllocVec(max, MEMF_ANY)))
+				{
+					FreeVec(s);
+					s = NULL;
+					break;
+				}
+				if(s) CopyMem(s, t, len);
+				FreeVec(s);
+				s = t;
+			}
+			CopyMem(pl.data[i], s + len, n);
+			len += n;
+		}
+		else if(!p && !(p = ezxml_parser_new(MyLibBase))) break;
+		else if(!ezxml_parse_chunk(p, pl.data[i], n, MyLibBase)) break;    // malformed
+
+		Forbid();    // block is free for the next read
+		pl.full[i] = FALSE;
+		if(!pl.done) Signal(pl.reader, SIGBREAKF_CTRL_F);
+		Permit();
+	}
+
+	Forbid();    // stop reading, if not done yet
+	pl.stop = TRUE;
+	if(!pl.done) Signal(pl.reader, SIGBREAKF_CTRL_F);
+	while(!pl.done) Wait(1UL << pl.sig);
+	Permit();
+	FreeSignal(pl.sig);
+	FreeVec(pl.data[0]);
+
+	if(n < 0)    // read error, the tree so far comes with the error
+	{
+		if(s) FreeVec(s);
+		s = NULL;
+		max = 0;
+		if(!p && !(p = ezxml_parser_new(MyLibBase))) return NULL;
+		if(!*p->root->err) ezxml_err(p->root, NULL, "read error");
+	}
+	if(max)
+	{
+		if(!s) return NULL;
+		if(!(root = (ezxml_root_t)ezxml_parse_str(s, len, MyLibBase)))
+		{
+			FreeVec(s);
+			return NULL;
+		}
+		root->len = -1; // so we know to free s in ezxml_free()
+		return &root->xml;
+	}
+	if(!p && !(p = ezxml_parser_new(MyLibBase))) return NULL;
+	return ezxml_parse_finish(p, MyLibBase);
+}
+
+//+ ezxml.library/ezxml_reader_open
+/****** ezxml.library/ezxml_reader_open ***************************************
+* NAME
+*  ezxml_reader_open() - creates a cursor reading a document event by event (V9)
+*
+* SYNOPSIS
+*  ezxml_reader_open(string, size);
+*  ezxml_reader_t ezxml_reader_open(STRPTR, ULONG);
+*
+* FUNCTION
+*  Creates a reader for a string of xml data. Unlike ezxml_parse_str() it
+*  builds no tree, the document is reported front to back as a sequence of
+*  events returned by ezxml_reader_next(). Like ezxml_parse_str() it modifies
+*  the data by adding null terminators and decoding ampersand sequences.
+*
+* INPUTS
+*  string - pointer to string with xml data
+*  size   - size of string without 0x00 char
+*
+* RESULT
+*  Returns a reader or NULL on failure.
+*
+* NOTES
+*  The string has to stay valid until the reader is closed with
+*  ezxml_reader_close().
+*
+* SEE ALSO
+*  ezxml_reader_next() ezxml_reader_error() ezxml_reader_close()
+********************************************************************************
+*
+*/
+//-
+ezxml_reader_t ezxml_reader_open(STRPTR s, ULONG len, struct LibBase *MyLibBase)
+{
+	ezxml_reader_t r;
+	ezxml_root_t root;
+
+	if(!(r = malloc(sizeof(struct ezxml_reader)))) return NULL;
+	r->root = root = (ezxml_root_t)ezxml_new(NULL, MyLibBase);
+	r->attr = malloc((r->amax = EZXML_NAMES) * sizeof(STRPTR));
+	r->tag = malloc((r->tmax = EZXML_NAMES) * sizeof(STRPTR));
+	if(!r->attr || !r->tag)
+	{
+		ezxml_reader_close(r, MyLibBase);
+		return NULL;
+	}
+
+	r->ev.attr = r->attr;
+	r->ev.txt = "";
+	*r->attr = NULL;
+	root->m = s;
+	if(!len) ezxml_err(root, NULL, "root tag missing");
+	else
+	{
+		root->u = ezxml_str2utf8(&s, &len, MyLibBase); // convert utf-16 to utf-8
+		root->e = (root->s = r->s = s) + len; // record start and end of work area
+		if(!ezxml_lines_to(root, root->e)) ezxml_err(root, NULL, "out of memory");
+		r->e = s[len - 1]; // save end char
+		s[len - 1] = '\0'; // turn end char into null terminator
+	}
+	return r;
+}
+
+// frees what was allocated for the current event of a reader
+static VOID ezxml_reader_release(ezxml_reader_t r, struct LibBase *MyLibBase)
+{
+	if(r->ev.type == EZXML_EV_START)
+	{
+		r->attr[r->given] = NULL;    // defaults belong to the document
+		ezxml_free_vals(r->root, r->attr);
+	}
+	else if(*r->ev.txt && !ezxml_in_src(r->root, r->ev.txt)) free(r->ev.txt);
+	*r->attr = NULL;
+	r->ev.type = 0;
+	r->ev.name = NULL;
+	r->ev.txt = "";
+	r->ev.len = 0;
+}
+
+//+ ezxml.library/ezxml_reader_next
+/****** ezxml.library/ezxml_reader_next ***************************************
+* NAME
+*  ezxml_reader_next() - reads next event of a document (V9)
+*
+* SYNOPSIS
+*  ezxml_reader_next(reader);
+*  ezxml_event_t ezxml_reader_next(ezxml_reader_t);
+*
+* FUNCTION
+*  Moves the reader to the next event of the document:
+*
+*   EZXML_EV_START   - start tag, name and attributes are set
+*   EZXML_EV_END     - end tag, name is set. Empty tags are reported as
+*                      a start tag followed by an end tag.
+*   EZXML_EV_TEXT    - character content of a tag or a cdata section, txt
+*                      and len are set
+*   EZXML_EV_PI      - processing instruction, name is the target and txt
+*                      the instruction
+*   EZXML_EV_COMMENT - comment, txt and len are set
+*
+*  depth is the number of tags enclosing the event, zero for the root tag.
+*  Strings are null terminated and point into the document where possible,
+*  so nothing is allocated per event in general.
+*
+* INPUTS
+*  reader - reader returned by ezxml_reader_open()
+*
+* RESULT
+*  Returns the event or NULL at the end of document or on error. The event
+*  stays valid until the next call.
+*
+* SEE ALSO
+*  ezxml_reader_open() ezxml_reader_error() ezxml_reader_close()
+********************************************************************************
+*
+*/
+//-
+ezxml_event_t ezxml_reader_next(ezxml_reader_t r, struct LibBase *MyLibBase)
+{
+	ezxml_root_t root;
+	struct ezxml_def *y;
+	ezxml_event_t ev;
+	STRPTR s, d, *a;
+	LONG l;
+	int i, j;
+	BYTE q, e;
+	UBYTE f;
+
+	if(!r) return NULL;
+	ezxml_reader_release(r, MyLibBase);
+	root = r->root;
+	ev = &r->ev;
+	d = s = r->s;
+	e = r->e;
+	if(*root->err) return NULL;
+
+	if(r->end)    // end of an empty tag
+	{
+		r->end = FALSE;
+		ev->type = EZXML_EV_END;
+		ev->name = r->tag[ev->depth = --r->depth];
+		r->done = !r->depth;
+		return ev;
+	}
+
+	for(; ;)
+	{
+		if(!r->lt && *s != '<')    // character content
+		{
+			if(!*s)    // end of document
+			{
+				if(r->depth) ezxml_err(root, d, "unclosed tag <%s>", r->tag[r->depth - 1]);
+				else if(!r->done) ezxml_err(root, d, "root tag missing");
+				r->s = s;
+				return NULL;
+			}
+
+			f = 0;
+			s = ezxml_scan(d = s, root->e, '<', EZXML_C_DEC, &f);
+			if(!*s || !r->depth) continue; // not followed by a tag or outside root tag
+
+			*s = '\0';
+			r->lt = TRUE;
+			r->s = s;
+			ev->type = EZXML_EV_TEXT;
+			ev->txt = (f) ? ezxml_decode(d, &root->ent, '&', NULL, MyLibBase) : d;
+			ev->len = (f) ? strlen(ev->txt) : s - d;
+			ev->depth = r->depth;
+			return ev;
+		}
+
+		r->lt = FALSE;
+		d = ++s;
+
+		if(isalpha(*s) || *s == '_' || *s == ':' || *s < '\0')    // start tag
+		{
+			if(r->done)
+			{
+				ezxml_err(root, d, "markup outside of root element");
+				return NULL;
+			}
+
+			s = ezxml_find(s, EZXML_C_WS | EZXML_C_SL | EZXML_C_GT);
+			a = ((y = ezxml_def_getn(root, d, s - d, NULL))) ? root->attr[y->i] : NULL;
+			while(EZXML_CC(*s) & EZXML_C_SP) *(s++) = '\0';  // null terminate tag name
+			if((r->given = l = ezxml_scan_attr(root, d, &s, &r->attr, &r->amax, NULL, MyLibBase)) < 0)
+				return NULL;
+
+			if((r->end = (*s == '/'))) *(s++) = '\0';  // empty tag
+			if((*s && *s != '>') || (!*s && e != '>'))
+			{
+				ezxml_free_vals(root, r->attr);
+				*r->attr = NULL;
+				ezxml_err(root, d, "missing >");
+				return NULL;
+			}
+
+			for(j = 1; a && a[j]; j += 3)    // add default attributes not given
+			{
+				for(i = 0; r->attr[i] && strcmp(r->attr[i], a[j]); i += 2);
+				if(r->attr[i] || !a[j + 1]) continue;
+				if(!ezxml_room(&r->attr, &r->amax, l + 3, MyLibBase)) break;
+				r->attr[l++] = a[j];
+				r->attr[l++] = a[j + 1];
+				r->attr[l] = NULL;
+			}
+
+			if(!ezxml_room(&r->tag, &r->tmax, r->depth + 1, MyLibBase) || (a && a[j]))
+			{
+				r->attr[r->given] = NULL;
+				ezxml_free_vals(root, r->attr);
+				*r->attr = NULL;
+				ezxml_err(root, d, "out of memory");
+				return NULL;
+			}
+
+			ev->type = EZXML_EV_START;
+			ev->attr = r->attr;
+			ev->name = r->tag[ev->depth = r->depth++] = d;
+		}
+		else if(*s == '/')    // end tag
+		{
+			s = ezxml_find(d = s + 1, EZXML_C_WS | EZXML_C_GT);
+			if(!*s && e != '>')
+			{
+				ezxml_err(root, d, "missing >");
+				return NULL;
+			}
+			q = *s;
+			*s = '\0'; // null terminate tag name
+			if(!r->depth || strcmp(r->tag[r->depth - 1], d))
+			{
+				ezxml_err(root, d, "unexpected closing tag </%s>", d);
+				return NULL;
+			}
+			if(EZXML_CC(q) & EZXML_C_SP) s = ezxml_skip(s + 1, EZXML_C_WS);
+			else *s = q;
+
+			ev->type = EZXML_EV_END;
+			ev->name = r->tag[ev->depth = --r->depth];
+			r->done = !r->depth;
+		}
+		else if(!strncmp(s, "!--", 3))    // xml comment
+		{
+			if(!(s = strstr(s + 3, "--")) || (*(s += 2) != '>' && *s) ||
+			        (!*s && e != '>'))
+			{
+				ezxml_err(root, d, "unclosed <!--");
+				return NULL;
+			}
+
+			*(s - 2) = '\0';
+			ev->type = EZXML_EV_COMMENT;
+			ev->txt = d + 3;
+			ev->len = s - d - 5;
+			ev->depth = r->depth;
+		}
+		else if(!strncmp(s, "![CDATA[", 8))    // cdata
+		{
+			if(!(s = strstr(s, "]]>")))
+			{
+				ezxml_err(root, d, "unclosed <![CDATA[");
+				return NULL;
+			}
+
+			*s = '\0';
+			s += 2;
+			if(r->depth)    // outside of the root tag it is ignored
+			{
+				ev->type = EZXML_EV_TEXT;
+				ev->len = strlen(ev->txt = ezxml_decode(d + 8, &root->ent, 'c', NULL, MyLibBase));
+				ev->depth = r->depth;
+			}
+		}
+		else if(!strncmp(s, "!DOCTYPE", 8))    // dtd
+		{
+			s = ezxml_dtd_end(s, &l);
+			if(!*s && e != '>')
+			{
+				ezxml_err(root, d, "unclosed <!DOCTYPE");
+				return NULL;
+			}
+			d = (l) ? strchr(d, '[') + 1 : d;
+			if(l && !ezxml_internal_dtd(root, d, s++ - d, MyLibBase)) return NULL;
+		}
+		else if(*s == '?')    // <?...?> processing instructions
+		{
+			s = ezxml_pi_end(s);
+			if(!s || (!*s && e != '>'))
+			{
+				ezxml_err(root, d, "unclosed <?");
+				return NULL;
+			}
+
+			ev->txt = ezxml_pi_split(d + 1, s - d - 2);
+			if(ezxml_xml_decl(root, d + 1, ev->txt)) ev->txt = "";
+			else
+			{
+				ev->type = EZXML_EV_PI;
+				ev->name = d + 1;
+				ev->len = strlen(ev->txt);
+				ev->depth = r->depth;
+			}
+		}
+		else
+		{
+			ezxml_err(root, d, "unexpected <");
+			return NULL;
+		}
+
+		if(*s) *(s++) = '\0';
+		r->s = s;
+		if(ev->type) return ev;
+	}
+}
+
+//+ ezxml.library/ezxml_reader_error
+/****** ezxml.library/ezxml_reader_error **************************************
+* NAME
+*  ezxml_reader_error() - returns parser error of a reader (V9)
+*
+* SYNOPSIS
+*  ezxml_reader_error(reader);
+*  CONST_STRPTR ezxml_reader_error(ezxml_reader_t);
+*
+* FUNCTION
+*  Tells why ezxml_reader_next() returned NULL before the end of document.
+*
+* INPUTS
+*  reader - reader returned by ezxml_reader_open()
+*
+* RESULT
+*  Returns error string or empty string if no error occurred.
+*
+* SEE ALSO
+*  ezxml_reader_next() ezxml_error()
+********************************************************************************
+*
+*/
+//-
+CONST_STRPTR ezxml_reader_error(ezxml_reader_t r)
+{
+	return (r) ? (CONST_STRPTR)r->root->err : "";
+}
+
+//+ ezxml.library/ezxml_reader_close
+/****** ezxml.library/ezxml_reader_close **************************************
+* NAME
+*  ezxml_reader_close() - disposes of a reader (V9)
+*
+* SYNOPSIS
+*  ezxml_reader_close(reader);
+*  VOID ezxml_reader_close(ezxml_reader_t);
+*
+* FUNCTION
+*  Frees the reader and everything allocated for it. The document data is
+*  not freed.
+*
+* INPUTS
+*  reader - reader returned by ezxml_reader_open(), can be NULL
+*
+* SEE ALSO
+*  ezxml_reader_open()
+********************************************************************************
+*
+*/
+//-
+VOID ezxml_reader_close(ezxml_reader_t r, struct LibBase *MyLibBase)
+{
+	if(!r) return;
+	if(r->attr && r->tag) ezxml_reader_release(r, MyLibBase);
+	if(r->attr) free(r->attr);
+	if(r->tag) free(r->tag);
+	ezxml_free(&r->root->xml, MyLibBase);
+	free(r);
+}
+
+// Makes room for n more bytes in o, flushing it if full. Returns FALSE if the
+// output failed.
+static inline BOOL ezxml_out_room(struct ezxml_out *o, ULONG n)
+{
+	if(o->len + n > o->max && !o->err && !o->flush(o, n)) o->err = TRUE;
+	return !o->err;
+}
+
+// Flush of ezxml_toxml(), grows the buffer geometrically to fit n more bytes.
+static BOOL ezxml_out_grow(struct ezxml_out *o, ULONG n)
+{
+	struct LibBase *MyLibBase = o->base;
+	ULONG max;
+	STRPTR s;
+
+	for(max = o->max * 2; o->len + n > max; max *= 2);
+	if(!(s = realloc(o->s, max))) return FALSE;
+	o->s = s;
+	o->max = max;
+	return TRUE;
+}
+
+// Encodes ampersand sequences of the first len bytes of s, or up to the null
+// terminator, writing the results to o. a is non-zero for attribute encoding.
+static VOID ezxml_ampencode(CONST_STRPTR s, ULONG len, struct ezxml_out *o, SHORT a)
+{
+	const char *e = s + len;
+
+	for(; s != e; s++)
+	{
+		if(!ezxml_out_room(o, 10)) return;
+
+		switch(*s)
+		{
+		case '\0':
+			return;
+		case '&':
+			o->len += sprintf(o->s + o->len, "&amp;");
+			break;
+		case '<':
+			o->len += sprintf(o->s + o->len, "&lt;");
+			break;
+		case '>':
+			o->len += sprintf(o->s + o->len, "&gt;");
+			break;
+		case '"':
+			o->len += sprintf(o->s + o->len, (a) ? "&quot;" : "\"");
+			break;
+		case '\n':
+			o->len += sprintf(o->s + o->len, (a) ? "&#xA;" : "\n");
+			break;
+		case '\t':
+			o->len += sprintf(o->s + o->len, (a) ? "&#x9;" : "\t");
+			break;
+		case '\r':
+			o->len += sprintf(o->s + o->len, "&#xD;");
+			break;
+		default:
+			o->s[o->len++] = *s;
+		}
+	}
+}
+
+// Converts each tag from xml on in the parent tag to xml, with the parent's
+// character content around them, writing it to o. Recurses into the children
+// only. Default attributes are those declared in the DTD of the document of
+// each tag.
+static VOID ezxml_toxml_r(ezxml_t xml, struct ezxml_out *o)
+{
+	struct LibBase *MyLibBase = o->base;
+	char *txt = ezxml_txt(xml->parent);
+	struct ezxml_def *d;
+	STRPTR *a;
+	ULONG off = 0, start;
+	int i, j;
+
+	for(; xml && !o->err; xml = xml->ordered)
+	{
+		d = ezxml_def_get(EZXML_DOC(xml), xml->name, NULL);
+		a = (d) ? EZXML_DOC(xml)->attr[d->i] : NULL;
+
+		// parent character content up to this tag, off is the previous tag
+		for(start = off; txt[off] && off < xml->off; off++); // within bounds
+		ezxml_ampencode(txt + start, off - start, o, 0);
+
+		if(!ezxml_out_room(o, strlen(xml->name) + 4)) return;
+		o->len += sprintf(o->s + o->len, "<%s", xml->name); // open tag
+		for(i = 0; xml->attr[i]; i += 2)    // tag attributes
+		{
+			for(j = 0; j < i && xml->attr[j] != xml->attr[i] &&
+			        strcmp(xml->attr[j], xml->attr[i]); j += 2);
+			if(j < i) continue;  // skip duplicates
+			ezxml_attr_val(xml, i, MyLibBase); // decodes lazily parsed values
+			if(!ezxml_out_room(o, strlen(xml->attr[i]) + 7)) return;
+			o->len += sprintf(o->s + o->len, " %s=\"", xml->attr[i]);
+			ezxml_ampencode(xml->attr[i + 1], -1, o, 1);
+			if(!ezxml_out_room(o, 2)) return;
+			o->len += sprintf(o->s + o->len, "\"");
+		}
+
+		for(j = 1; a && a[j]; j += 3)    // default attributes
+		{
+			if(!a[j + 1] || ezxml_attr(xml, a[j]) != a[j + 1])
+				continue; // skip duplicates and non-values
+			if(!ezxml_out_room(o, strlen(a[j]) + 7)) return;
+			o->len += sprintf(o->s + o->len, " %s=\"", a[j]);
+			ezxml_ampencode(a[j + 1], -1, o, 1);
+			if(!ezxml_out_room(o, 2)) return;
+			o->len += sprintf(o->s + o->len, "\"");
+		}
+		if(!ezxml_out_room(o, 2)) return;
+		o->len += sprintf(o->s + o->len, ">");
+
+		if(xml->child) ezxml_toxml_r(xml->child, o); // child
+		else ezxml_ampencode(ezxml_txt(xml), -1, o, 0); // data
+
+		if(!ezxml_out_room(o, strlen(xml->name) + 4)) return;
+		o->len += sprintf(o->s + o->len, "</%s>", xml->name); // close tag
+	}
+	ezxml_ampencode(txt + off, -1, o, 0);
+}
+
+// Converts xml to xml as ezxml_toxml() does, writing it to o.
+static VOID ezxml_toxml_out(ezxml_t xml, struct ezxml_out *o)
+{
+	ezxml_t p = (xml) ? xml->parent : NULL, ord = (xml) ? xml->ordered : NULL;
+	ezxml_root_t root = (xml) ? EZXML_DOC(xml) : NULL;
+	char *t, *n;
+	int i, j, k, top = (xml && !p && &root->xml == xml); // prints the document
+
+	if(!xml || !xml->name) return;
+
+	for(i = 0; top && root->pi[i]; i++)    // pre-root processing instructions
+	{
+		for(k = 2; root->pi[i][k - 1]; k++);
+		for(j = 1; (n = root->pi[i][j]); j++)
+		{
+			if(root->pi[i][k][j - 1] == '>') continue;  // not pre-root
+			if(!ezxml_out_room(o, strlen(t = root->pi[i][0]) + strlen(n) + 7)) return;
+			o->len += sprintf(o->s + o->len, "<?%s%s%s?>\n", t, *n ? " " : "", n);
+		}
+	}
+
+	xml->parent = xml->ordered = NULL;
+	ezxml_toxml_r(xml, o);
+	xml->parent = p;
+	xml->ordered = ord;
+
+	for(i = 0; top && root->pi[i]; i++)    // post-root processing instructions
+	{
+		for(k = 2; root->pi[i][k - 1]; k++);
+		for(j = 1; (n = root->pi[i][j]); j++)
+		{
+			if(root->pi[i][k][j - 1] == '<') continue;  // not post-root
+			if(!ezxml_out_room(o, strlen(t = root->pi[i][0]) + strlen(n) + 7)) return;
+			o->len += sprintf(o->s + o->len, "\n<?%s%s%s?>", t, *n ? " " : "", n);
+		}
+	}
+}
+
+//+ ezxml.library/ezxml_toxml
+/****** ezxml.library/ezxml_toxml *********************************************
+* NAME
+*  ezxml_toxml() - converts an ezxml structure back to xml (V8)
+*
+* SYNOPSIS
+*  ezxml_toxml(xml);
+*  STRPTR ezxml_toxml(ezxml_t);
+*
+* FUNCTION
+*  Reads a ezxml_t structure and converts it's to string contains xml data.
+*
+* INPUTS
+*  xml - ezxml_t structure
+*
+* RESULT
+*	Return a pointer to string contains requested tag or NULL if out of memory.
+*
+* NOTES
+*  String have to be freed by calling FreeVec()!
+*
+* SEE ALSO
+*  ezxml_toxml_fd() ezxml_toxml_cb() ezxml_toxml_gz()
+********************************************************************************
+*
+*/
+//-
+STRPTR ezxml_toxml(ezxml_t xml, struct LibBase *MyLibBase)
+{
+	struct ezxml_out o = { NULL, 0, EZXML_BUFSIZE, ezxml_out_grow, NULL, MyLibBase, FALSE };
+
+	if(!(o.s = malloc(o.max))) return NULL;
+	ezxml_toxml_out(xml, &o);
+	if(!ezxml_out_room(&o, 1))
+	{
+		free(o.s);
+		return NULL;
+	}
+	o.s[o.len] = '\0';
+	return realloc(o.s, o.len + 1);
+}
+
+#ifndef EZXML_NOZLIB
+struct ezxml_zout         // compressed output of ezxml_toxml_gz()
+{
+	z_stream z;
+	BPTR fd;               // file written to
+	UBYTE *w;              // window of EZXML_ZWINDOW bytes deflated into
+};
+
+// Deflates the len bytes at s into the file of zo, flush as for deflate().
+// Returns FALSE on failure.
+static BOOL ezxml_zwrite(struct ezxml_zout *zo, STRPTR s, ULONG len, int flush,
+                         struct LibBase *MyLibBase)
+{
+	LONG n;
+
+	zo->z.next_in = (UBYTE *)s;
+	zo->z.avail_in = len;
+	do
+	{
+		zo->z.next_out = zo->w;
+		zo->z.avail_out = EZXML_ZWINDOW;
+		if(deflate(&zo->z, flush) == Z_STREAM_ERROR) return FALSE;
+		n = EZXML_ZWINDOW - zo->z.avail_out;
+		if(n && Write(zo->fd, zo->w, n) != n) return FALSE;
+	}
+	while(!zo->z.avail_out);
+	return TRUE;
+}
+
+// Flush of ezxml_toxml_gz(), deflates the buffer and grows it only for n bytes
+// larger than the buffer.
+static BOOL ezxml_out_gz(struct ezxml_out *o, ULONG n)
+{
+	if(!ezxml_zwrite(o->data, o->s, o->len, Z_NO_FLUSH, o->base)) return FALSE;
+	o->len = 0;
+	return n <= o->max || ezxml_out_grow(o, n);
+}
+#endif // EZXML_NOZLIB
+
+//+ ezxml.library/ezxml_toxml_gz
+/****** ezxml.library/ezxml_toxml_gz ******************************************
+* NAME
+*  ezxml_toxml_gz() - writes an ezxml structure as gzip compressed xml (V9)
+*
+* SYNOPSIS
+*  ezxml_toxml_gz(xml, fd);
+*  LONG ezxml_toxml_gz(ezxml_t, BPTR);
+*
+* FUNCTION
+*  Converts a ezxml_t structure to xml data as ezxml_toxml() does and writes
+*  it gzip compressed to a file. The xml data is deflated as it is produced,
+*  only small windows of it are held in memory.
+*
+* INPUTS
+*  xml - ezxml_t structure
+*  fd  - file handle to write to
+*
+* RESULT
+*  Returns non-zero on success or zero if memory ran out or writing failed.
+*
+* NOTES
+*  The file is not closed. ezxml_parse_file() reads the result back. Always
+*  fails if the library was built without zlib.
+*
+* SEE ALSO
+*  ezxml_toxml() ezxml_parse_file()
+********************************************************************************
+*
+*/
+//-
+LONG ezxml_toxml_gz(ezxml_t xml, BPTR fd, struct LibBase *MyLibBase)
+{
+#ifndef EZXML_NOZLIB
+	struct ezxml_zout zo;
+	struct ezxml_out o = { NULL, 0, EZXML_ZWINDOW, ezxml_out_gz, &zo, MyLibBase, FALSE };
+
+	if(!fd) return FALSE;
+	memset(&zo, 0, sizeof(zo));
+	zo.z.zalloc = ezxml_zalloc;
+	zo.z.zfree = ezxml_zfree;
+	zo.z.opaque = MyLibBase;
+	zo.fd = fd;
+	if(deflateInit2(&zo.z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, // gzip
+	                Z_DEFAULT_STRATEGY) != Z_OK) return FALSE;
+
+	// o.s may get reallocated, so it doesn't share an allocation with the window
+	if((o.s = AllocVec(o.max, MEMF_ANY)) && (zo.w = AllocVec(EZXML_ZWINDOW, MEMF_ANY)))
+	{
+		ezxml_toxml_out(xml, &o);
+		if(!o.err && !ezxml_zwrite(&zo, o.s, o.len, Z_FINISH, MyLibBase)) o.err = TRUE;
+	}
+	else o.err = TRUE;
+
+	deflateEnd(&zo.z);
+	if(zo.w) FreeVec(zo.w);
+	if(o.s) FreeVec(o.s);
+	return !o.err;
+#else
+	return FALSE;
+#endif // EZXML_NOZLIB
+}
+
+// Flush of ezxml_toxml_fd(), writes the buffer to the file o->data is.
+static BOOL ezxml_out_fd(struct ezxml_out *o, ULONG n)
+{
+	struct LibBase *MyLibBase = o->base;
+
+	if(o->len && Write((BPTR)o->data, o->s, o->len) != o->len) return FALSE;
+	o->len = 0;
+	return n <= o->max || ezxml_out_grow(o, n);
+}
+
+// Flush of ezxml_toxml_cb(), passes the buffer to the callback.
+static BOOL ezxml_out_cb(struct ezxml_out *o, ULONG n)
+{
+	struct ezxml_sink *k = o->data;
+
+	if(o->len && !k->fn(o->s, o->len, k->data)) return FALSE;
+	o->len = 0;
+	return n <= o->max || ezxml_out_grow(o, n);
+}
+
+// Converts xml to xml through a buffer of EZXML_OUTSIZE bytes, which flush
+// passes on as it fills. Returns FALSE on failure.
+static LONG ezxml_toxml_sink(ezxml_t xml, BOOL (*flush)(struct ezxml_out *o, ULONG n),
+                             APTR data, struct LibBase *MyLibBase)
+{
+	struct ezxml_out o = { NULL, 0, EZXML_OUTSIZE, flush, data, MyLibBase, FALSE };
+
+	if(!(o.s = AllocVec(o.max, MEMF_ANY))) return FALSE;
+	ezxml_toxml_out(xml, &o);
+	if(!o.err && o.len && !flush(&o, 0)) o.err = TRUE;
+	FreeVec(o.s);
+	return !o.err;
+}
+
+//+ ezxml.library/ezxml_toxml_fd
+/****** ezxml.library/ezxml_toxml_fd ******************************************
+* NAME
+*  ezxml_toxml_fd() - writes an ezxml structure as xml to a file (V9)
+*
+* SYNOPSIS
+*  ezxml_toxml_fd(xml, fd);
+*  LONG ezxml_toxml_fd(ezxml_t, BPTR);
+*
+* FUNCTION
+*  Converts a ezxml_t structure to xml data as ezxml_toxml() does and writes
+*  it to a file. The data goes through a small buffer written out whenever it
+*  fills, the document is never held whole in memory.
+*
+* INPUTS
+*  xml - ezxml_t structure
+*  fd  - file handle to write to
+*
+* RESULT
+*  Returns non-zero on success or zero if memory ran out or writing failed.
+*
+* NOTES
+*  The file is not closed. Data written before a failure stays in the file.
+*
+* SEE ALSO
+*  ezxml_toxml() ezxml_toxml_cb() ezxml_toxml_gz()
+********************************************************************************
+*
+*/
+//-
+LONG ezxml_toxml_fd(ezxml_t xml, BPTR fd, struct LibBase *MyLibBase)
+{
+	return (fd) ? ezxml_toxml_sink(xml, ezxml_out_fd, (APTR)fd, MyLibBase) : FALSE;
+}
+
+//+ ezxml.library/ezxml_toxml_cb
+/****** ezxml.library/ezxml_toxml_cb ******************************************
+* NAME
+*  ezxml_toxml_cb() - passes an ezxml structure as xml to a callback (V9)
+*
+* SYNOPSIS
+*  ezxml_toxml_cb(xml, fn, data);
+*  LONG ezxml_toxml_cb(ezxml_t, ezxml_write_f, APTR);
+*
+* FUNCTION
+*  Converts a ezxml_t structure to xml data as ezxml_toxml() does and passes
+*  it to a callback piece by piece, each time a small buffer fills and once
+*  more at the end. The callback gets the buffer, the number of bytes in it
+*  and data, and returns zero to stop.
+*
+* INPUTS
+*  xml  - ezxml_t structure
+*  fn   - callback taking the xml data
+*  data - passed on to the callback
+*
+* RESULT
+*  Returns non-zero on success or zero if memory ran out or the callback
+*  stopped.
+*
+* NOTES
+*  The buffer is not null terminated and is reused once the callback returns.
+*
+* SEE ALSO
+*  ezxml_toxml() ezxml_toxml_fd()
+********************************************************************************
+*
+*/
+//-
+LONG ezxml_toxml_cb(ezxml_t xml, ezxml_write_f fn, APTR data, struct LibBase *MyLibBase)
+{
+	struct ezxml_sink k = { fn, data };
+
+	return (fn) ? ezxml_toxml_sink(xml, ezxml_out_cb, &k, MyLibBase) : FALSE;
+}
+
+// frees the malloced strings of xml and the tags below it and documents inserted
+// there, the tags themselves are released with the arena of their document
+static VOID ezxml_free_tags(ezxml_t xml, struct LibBase *MyLibBase)
+{
+	ezxml_t top = xml, next;
+	BOOL doc;
+
+	while(xml)
+	{
+		if(!(doc = (xml != top && EZXML_DOC(xml) == (ezxml_root_t)xml)))
+		{
+			ezxml_free_attr(xml->attr, MyLibBase); // tag attributes
+			if((xml->flags & EZXML_TXTM) && xml->txt) free(xml->txt);  // character content
+			if((xml->flags & EZXML_NAMEM) && xml->name) free(xml->name);  // tag name
+		}
+
+		if(!(next = (doc) ? NULL : xml->child))    // go to next tag in order
+		{
+			for(next = xml; next != top && !next->ordered; next = next->parent);
+			next = (next != top) ? next->ordered : NULL;
+		}
+		if(doc) ezxml_free(xml, MyLibBase);  // root of an inserted document
+		xml = next;
+	}
+}
+
+//+ ezxml.library/ezxml_free
+/****** ezxml.library/ezxml_free ***********************************************
+* NAME
+*  ezxml_free() - frees the memory allocated for an ezxml structure (V8)
+*
+* SYNOPSIS
+*  ezxml_free(xml);
+*  VOID ezxml_free(ezxml_t);
+*
+* FUNCTION
+*  Frees the memory allocated for an ezxml structure. When you call it for structure,
+*  which have subtags, etc. it will automatically free any child.
+*
+*  Tags of a document are allocated together with it. When called for the root
+*  tag the whole document is released at once, when called for any other tag
+*  (like ezxml_remove() does) only strings it owns are freed and the memory of
+*  the tags is released with their document.
+*
+* INPUTS
+*  xml - ezxml_t tag structure
+*
+* NOTES
+*  Tags removed from a document, and the attribute lists and text they used,
+*  keep their memory until the document itself is freed. A document which
+*  keeps having tags added and removed grows until then.
+*
+* SEE ALSO
+*  ezxml_parse_str() ezxml_parse_fd() ezxml_parse_file() ezxml_new()
+********************************************************************************
+*
+*/
+//-
+VOID ezxml_free(ezxml_t xml, struct LibBase *MyLibBase)
+{
+	ezxml_root_t root = (ezxml_root_t)xml;
+	struct ezxml_block *b;
+	struct ezxml_chunk *c, *n;
+	int i, j;
+	char **a;
+
+	if(!xml) return;
+	if(EZXML_DOC(xml) != root || root->mixed) ezxml_free_tags(xml, MyLibBase);
+
+	if(EZXML_DOC(xml) == root)    // free root tag allocations
+	{
+		for(i = 0; (a = root->attr[i]); i++)
+		{
+			for(j = 1; a[j++]; j += 2)  // free malloced attribute values
+				if(a[j] && !ezxml_in_src(root, a[j])) free(a[j]);
+			if(a) free(a);
+		}
+		if(root->attr[0] && root->attr) free(root->attr);  // free default attribute list
+
+		for(i = 0; root->pi[i]; i++)
+		{
+			for(j = 1; root->pi[i][j]; j++);
+			if(root->pi[i][j + 1])free(root->pi[i][j + 1]);
+			if(root->pi[i]) free(root->pi[i]);
+		}
+		if(root->pi[0] && root->pi) free(root->pi);  // free processing instructions
+
+		if(root->len == -1 && root->m) free(root->m);  // malloced xml data
+#ifndef EZXML_NOMMAP
+		else if(root->len) munmap(root->m, root->len);  // mem mapped xml data
+#endif /* EZXML_NOMMAP */
+		if(root->u) free(root->u);  // utf8 conversion
+
+		while(root->index) ezxml_index_drop(root->index, MyLibBase);  // value indexes
+
+		if(root->nl) free(root->nl);  // line index
+		if(root->tmp) free(root->tmp);  // scratch attribute list
+		if(root->tmpf) free(root->tmpf);
+
+		while((b = root->blk))    // push parser input
+		{
+			root->blk = b->next;
+			free(b);
+		}
+
+		for(c = root->mem; c; c = n)    // arena, the root itself is in the last chunk
+		{
+			n = c->next;
+			free(c);
+		}
+	}
+}
+
+//+ ezxml.library/ezxml_error
+/****** ezxml.library/ezxml_error ***********************************************
+* NAME
+*  ezxml_error() - reads error message (V8)
+*
+* SYNOPSIS
+*  ezxml_error(xml);
+*  CONST_STRPTR ezxml_error(ezxml_t);
+*
+* FUNCTION
+*  Reads error messages from ezxml_t structure.
+*
+* INPUTS
+*  xml - ezxml_t tag structure
+*
+* RESULT
+*  Returns pointer to string contains error message.
+*
+* SEE ALSO
+*  ezxml_parse_str() ezxml_parse_fd() ezxml_parse_file()
+********************************************************************************
+*
+*/
+//-
+CONST_STRPTR ezxml_error(ezxml_t xml)
+{
+	return (xml) ? EZXML_DOC(xml)->err : "";
+}
+
+//+ ezxml.library/ezxml_new
+/****** ezxml.library/ezxml_new *************************************************
+* NAME
+*  ezxml_new() - creates a new ezxml_t structure (V8)
+*
+* SYNOPSIS
+*  ezxml_new(name);
+*  ezxml_t ezxml_new(CONST_STRPTR);
+*
+* FUNCTION
+*  Creates a new ezxml_t structure with given root tag name.
+*
+* INPUTS
+*  name - name of the root tag
+*
+* RESULT
+*  Returns new ezxml_t structure with given root tag name.
+*
+* NOTES
+*  Name won't be copied. Please pay attention for not freeing it to early or use ezxml_new_d().
+*  For full compatibility with ezxml_free() please use AllocVec() to alloc memory for
+*  name string.
+*
+* SEE ALSO
+*  ezxml_free() ezxml_new_d()
+********************************************************************************
+*
+*/
+//-
+ezxml_t ezxml_new(CONST_STRPTR name, struct LibBase *MyLibBase)
+{
+	struct ezxml_chunk *c;
+	ezxml_root_t root;
+
+	if(!(c = ezxml_chunk(EZXML_CHUNK, EZXML_ALIGN(sizeof(struct ezxml_root)),
+	                     MyLibBase))) return NULL;
+	root = (ezxml_root_t)EZXML_MEM(c); // the document arena starts with the root
+	root->doc = root;
+	root->mem = c;
+	root->base = MyLibBase;
+	root->xml.name = (char *)name;
+	root->cur = &root->xml;
+	root->pos = EZXML_NOPOS;
+	strcpy(root->err, root->xml.txt = "");
+	root->attr = root->pi = (char ***)(root->xml.attr = EZXML_NIL);
+	return &root->xml;
+}
+
+// Finds the last tag of the sibling list of the subtags of xml again, after it
+// was reordered. Walks the list, as the callers do anyway.
+static void ezxml_stail_set(ezxml_t xml)
+{
+	ezxml_t cur;
+
+	for(cur = xml->child; cur && cur->sibling; cur = cur->sibling);
+	EZXML_NODE(xml)->stail = cur;
+}
+
+//+ ezxml.library/ezxml_insert
+/****** ezxml.library/ezxml_insert **********************************************
+* NAME
+*  ezxml_insert() - inserts an existing tag (V8)
+*
+* SYNOPSIS
+*  ezxml_insert(xml, dest, off);
+*  ezxml_t ezxml_insert(ezxml_t, ezxml_t, ULONG);
+*
+* FUNCTION
+*  Inserts an exisiting tag into ezxml_t structure.
+*
+* INPUTS
+*  xml  - source ezxml_t structure
+*  dest - destination ezxml_structure
+*  off  - offset
+*
+* RESULT
+*  Returns the tag.
+*
+* NOTES
+*  A tag taken from another document still lives in the memory of that document,
+*  which must not be freed before. The root tag of a document created with
+*  ezxml_new() is an exception, the whole document is then freed together with
+*  the one it was inserted into.
+*
+*  Appending a tag at or after the offset of the last subtag of dest takes
+*  constant time, as the parser does for every tag.
+*
+* SEE ALSO
+*  ezxml_move()
+********************************************************************************
+*
+*/
+//-
+ezxml_t ezxml_insert(ezxml_t xml, ezxml_t dest, ULONG off)
+{
+	ezxml_t cur, prev, head, last = EZXML_NODE(dest)->last;
+
+	ezxml_index_touch(dest, 0, NULL);
+	if(EZXML_DOC(xml) != EZXML_DOC(dest))    // tag of another document
+	{
+		for(cur = dest; cur->parent; cur = cur->parent);
+		EZXML_DOC(cur)->mixed = TRUE; // look for it when freeing the tree
+		EZXML_DOC(xml)->lent = TRUE;
+	}
+
+	xml->next = xml->sibling = xml->ordered = NULL;
+	xml->off = off;
+	xml->parent = dest;
+	EZXML_NODE(xml)->tail = xml;
+	EZXML_NODE(xml)->vec = NULL;
+	EZXML_NODE(xml)->count = 1;
+
+	if(last && last->off <= off)    // appended after the last subtag
+	{
+		last->ordered = xml;
+		EZXML_NODE(dest)->last = xml;
+
+		if((cur = ezxml_name_get(dest, xml->name)))    // not first of type
+		{
+			EZXML_NODE(cur)->tail->next = xml;
+			EZXML_NODE(cur)->tail = xml;
+			EZXML_NODE(cur)->count++;
+			ezxml_vec_push(cur, xml);
+		}
+		else   // first tag of this type, last of the siblings
+		{
+			EZXML_NODE(dest)->stail->sibling = xml;
+			EZXML_NODE(dest)->stail = xml;
+			ezxml_name_add(dest, xml);
+		}
+	}
+	else if((head = dest->child))    // already have sub tags
+	{
+		if(head->off <= off)    // not first subtag
+		{
+			for(cur = head; cur->ordered && cur->ordered->off <= off;
+			        cur = cur->ordered);
+			xml->ordered = cur->ordered;
+			cur->ordered = xml;
+			if(!xml->ordered) EZXML_NODE(dest)->last = xml;
+		}
+		else   // first subtag
+		{
+			xml->ordered = head;
+			dest->child = xml;
+		}
+
+		for(cur = head, prev = NULL; cur && strcmp(cur->name, xml->name);
+		        prev = cur, cur = cur->sibling); // find tag type
+		if(cur && cur->off <= off)    // not first of type
+		{
+			for(head = cur; cur->next && cur->next->off <= off; cur = cur->next);
+			xml->next = cur->next;
+			cur->next = xml;
+			EZXML_NODE(head)->count++;
+			if(xml->next) EZXML_NODE(head)->vec = NULL;  // indexes have moved
+			else   // last of type
+			{
+				EZXML_NODE(head)->tail = xml;
+				ezxml_vec_push(head, xml);
+			}
+		}
+		else   // first tag of this type
+		{
+			if(prev && cur) prev->sibling = cur->sibling;  // remove old first
+			else if(cur) head = cur->sibling; // old first led the sibling list
+			if(cur)    // takes over the next list of the old first
+			{
+				EZXML_NODE(xml)->tail = EZXML_NODE(cur)->tail;
+				EZXML_NODE(xml)->count = EZXML_NODE(cur)->count + 1;
+				EZXML_NODE(cur)->vec = NULL;
+				ezxml_name_set(dest, cur, xml);
+			}
+			else ezxml_name_add(dest, xml);
+			xml->next = cur; // old first tag is now next
+			for(cur = head, prev = NULL; cur && cur->off <= off;
+			        prev = cur, cur = cur->sibling); // new sibling insert point
+			xml->sibling = cur;
+			if(prev) prev->sibling = xml;
+			ezxml_stail_set(dest);
+		}
+	}
+	else   // only sub tag
+	{
+		dest->child = EZXML_NODE(dest)->last = EZXML_NODE(dest)->stail = xml;
+		ezxml_name_add(dest, xml);
+	}
+
+	return xml;
+}
+
+//+ ezxml.library/ezxml_add_child
+/****** ezxml.library/ezxml_add_child *****************************************
+* NAME
+*  ezxml_add_child() - adds a child tag (V8)
+*
+* SYNOPSIS
+*  ezxml_add_child(xml, name, off);
+*  ezxml_t ezxml_add_child(ezxml_t, CONST_STRPTR, ULONG);
+*
+* FUNCTION
+*  Adds a child to given tag with specified name. Off is the offset of the child tag
+*  relative to the start of the parent tag's character content.
+*
+* INPUTS
+*  xml  - ezxml_t structure of parents' tag
+*  name - name of the child tag
+*  off  - offset of the child tag relative to the start of the parent tag's character content
+*
+* RESULT
+*  Returns the child tag.
+*
+* NOTES
+*  Name won't be copied. Please pay attention for not freeing it to early or use ezxml_add_child_d().
+*  For full compatibility with ezxml_free() please use AllocVec() to alloc memory for name string.
+*
+* SEE ALSO
+*  ezxml_free() ezxml_new() ezxml_add_child_d()
+********************************************************************************
+*
+*/
+//-
+ezxml_t ezxml_add_child(ezxml_t xml, CONST_STRPTR name, ULONG off, struct LibBase *MyLibBase)
+{
+	ezxml_t child;
+
+	if(!xml || !(child = ezxml_alloc(EZXML_DOC(xml), sizeof(struct ezxml_node),
+	                                 MyLibBase))) return NULL;  // cleared
+	EZXML_DOC(child) = EZXML_DOC(xml);
+	EZXML_NODE(child)->pos = EZXML_NOPOS;
+	child->name = (char *)name;
+	child->attr = EZXML_NIL;
+	child->txt = "";
+
+	return ezxml_insert(child, xml, off);
+}
+
+//+ ezxml.library/ezxml_set_text
+/****** ezxml.library/ezxml_set_text ********************************************
+* NAME
+*  ezxml_set_text() - sets the character content for the given tag (V8)
+*
+* SYNOPSIS
+*  ezxml_set_txt(xml, txt);
+*  ezxml_t ezxml_set_txt(ezxml_t, CONST_STRPTR);
+*
+* FUNCTION
+*  Sets the content of the given tag.
+*
+* INPUTS
+*  xml - ezxml_t structure of tag
+*  txt - contents to be placed in tag
+*
+* RESULT
+*  Returns the tag.
+*
+* NOTES
+*  Txt won't be copied. Please pay attention for not freeing it to early or use ezxml_set_text_d().
+*  For full compatibility with ezxml_free() please use AllocVec() to alloc memory for txt string.
+*
+* SEE ALSO
+*  ezxml_free() ezxml_set_text_d() ezxml_set_attr() ezxml_set_flag()
+********************************************************************************
+*
+*/
+//-
+ezxml_t ezxml_set_txt(ezxml_t xml, CONST_STRPTR txt, struct LibBase *MyLibBase)
+{
+	if(!xml) return NULL;
+	ezxml_index_touch(xml, EZXML_Q_TXT, xml->name);
+	if(xml->flags & EZXML_TXTM) free(xml->txt);  // existing txt was malloced
+	xml->flags &= ~(EZXML_TXTM | EZXML_TXTS | EZXML_TXTD);
+	xml->txt = (char *)txt;
+	EZXML_NODE(xml)->seg = NULL;  // segments of the old text are dropped
+	EZXML_NODE(xml)->len = (txt) ? strlen(txt) : 0;
+	return xml;
+}
+
+//+ ezxml.library/ezxml_set_attr
+/****** ezxml.library/ezxml_set_attr ********************************************
+* NAME
+*  ezxml_set_attr() - sets the given tag attribute (V8)
+*
+* SYNOPSIS
+*  ezxml_set_attr(xml, name, value);
+*  ezxml_t ezxml_set_attr(ezxml_t, CONST_STRPTR, CONST_STRPTR);
+*
+* FUNCTION
+*  Sets the given tag attribute or creates a new attribute if not found.
+*  A value of NULL will remove the specified attribute.
+*
+* INPUTS
+*  xml - ezxml_t structure of tag
+*  name - name of attribute
+*  value - value of attribute
+*
+* RESULT
+*  Returns the tag given.
+*
+* NOTES
+*  Name and value won't be copied. So pay attention for not freeing it too early.
+*  For full compatibility with ezxml_free() please use AllocVec() to alloc memory for strings.
+*
+* SEE ALSO
+*  ezxml_free() ezxml_set_text() ezxml_set_attr_d() ezxml_set_flag()
+********************************************************************************
+*
+*/
+//-
+ezxml_t ezxml_set_attr(ezxml_t xml, CONST_STRPTR name, CONST_STRPTR value, struct LibBase* MyLibBase)
+{
+	int l = 0, c, n;
+	char **a, *m;
+
+	if(!xml) return NULL;
+	ezxml_index_touch(xml, EZXML_Q_ATTR, name);
+
+	while(xml->attr[l] && strcmp(xml->attr[l], name)) l += 2;
+	for(c = l; xml->attr[c]; c += 2);  // find end of attribute list
+	m = (c) ? xml->attr[c + 1] : ""; // list of which names/vals are malloced
+	if(!xml->attr[l])    // not found, add as new attribute
+	{
+		if(!value)    // nothing to do
+		{
+			if(xml->flags & EZXML_DUP) free((char *)name);  // name was strduped
+			xml->flags &= ~EZXML_DUP;
+			return xml;
+		}
+
+		if(c / 2 < EZXML_NODE(xml)->amax) a = xml->attr;    // room left
+		else    // lists live in the arena of the document, make a copy with room
+		{       // for as many attributes again, so copies add up to O(n)
+			n = (c) ? c : 4;
+			if(!(a = ezxml_alloc(EZXML_DOC(xml), (2 * n + 2) * sizeof(char *) + n + 1,
+			                     MyLibBase))) return xml;  // cleared
+			memcpy(a, xml->attr, c * sizeof(char *));
+			memcpy(a + 2 * n + 2, m, c / 2);  // list of malloced names/vals follows
+			m = (char *)(a + 2 * n + 2);
+			EZXML_NODE(xml)->amax = n;
+		}
+		m[c / 2] = (xml->flags & EZXML_DUP) ? EZXML_NAMEM : ' ';
+		m[c / 2 + 1] = '\0';
+		a[c] = (char *)name; // set attribute name
+		a[c + 1] = ""; // no value yet
+		a[c + 2] = NULL;
+		a[c + 3] = m;
+		xml->attr = a;
+		c += 2;
+	}
+	else if(xml->flags & EZXML_DUP) free((char *)name);  // name was strduped
+
+	if(m[l / 2] & EZXML_TXTM) free(xml->attr[l + 1]);  // old value was malloced
+	if(value)
+	{
+		xml->attr[l + 1] = (char *)value; // set attribute value
+		if(xml->flags & EZXML_DUP) m[l / 2] |= EZXML_TXTM;
+		else m[l / 2] &= ~EZXML_TXTM;
+		m[l / 2] &= ~(EZXML_TXTD | EZXML_TXTN); // nothing left to decode
+	}
+	else   // remove attribute
+	{
+		if(m[l / 2] & EZXML_NAMEM) free(xml->attr[l]);
+		memmove(xml->attr + l, xml->attr + l + 2, (c - l) * sizeof(char *));
+		memmove(m + (l / 2), m + (l / 2) + 1, (c / 2) - (l / 2)); // and flags
+	}
+	xml->flags &= ~EZXML_DUP; // clear strdup() flag
+	return xml;
+}
+
+//+ ezxml.library/ezxml_set_flag
+/****** ezxml.library/ezxml_set_flag *****************************************
+* NAME
+*  ezxml_set_flag() - sets the flag for the given tag (V8)
+*
+* SYNOPSIS
+*  ezxml_set_flag(xml, flag);
+*  ezxml_t ezxml_set_flag(ezxml_t, SHORT);
+*
+* FUNCTION
+*  Sets a flag for the given tag.
+*
+* INPUTS
+*  xml  - ezxml_t structure of tag
+*  flag - flag to be set
+*
+* RESULT
+*  Returns the tag given.
+*
+* SEE ALSO
+*  ezxml_set_text() ezxml_set_attr_d() ezxml_set_flag()
+********************************************************************************
+*
+*/
+//-
+ezxml_t ezxml_set_flag(ezxml_t xml, SHORT flag)
+{
+	if(!xml) return NULL;
+	xml->flags |= flag;
+	if(flag & (EZXML_NAMEM | EZXML_TXTM | EZXML_DUP))
+		EZXML_DOC(xml)->mixed = TRUE; // tree has malloced strings to free
+	return xml;
+}
+
+//+ ezxml.library/ezxml_cut
+/****** ezxml.library/ezxml_cut ***********************************************
+* NAME
+*  ezxml_cut() - removes a tag along with its subtags (V8)
+*
+* SYNOPSIS
+*  ezxml_cut(xml);
+*  ezxml_t ezxml_cut(ezxml_t);
+*
+* FUNCTION
+*  Removes a tag along with its subtags.
 *
 * INPUTS
-*  string - pointer to string with xml data
-*  size   - size of string without 0x00 char
+*  xml - ezxml_t structure of tag to be cut
 *
 * RESULT
-*	Returns ezxml_t structure or NULL on failure.
+*  Returns the tag given.
 *
 * NOTES
-*  Notice that original data will be modified.
-*  Don't forget to free allocated memory with ezxml_free()
+*  This function does not freeing memory!
 *
 * SEE ALSO
-*  ezxml_parse_fd() ezxml_parse_file() ezxml_free()
+*  ezxml_remove() ezxml_free()
 ********************************************************************************
 *
 */
 //-
-ezxml_t ezxml_parse_str(STRPTR s, ULONG len, struct LibBase *MyLibBase)
+ezxml_t ezxml_cut(ezxml_t xml)
 {
-	ezxml_root_t root = (ezxml_root_t)ezxml_new(NULL, MyLibBase);
-	BYTE q, e;
-	STRPTR d, *attr, *a = NULL; // initialize a to avoid compile warning
-	int l, i, j;
-
-	root->m = s;
-	if(!len) return ezxml_err(root, NULL, "root tag missing");
-	root->u = ezxml_str2utf8(&s, &len, MyLibBase); // convert utf-16 to utf-8
-	root->e = (root->s = s) + len; // record start and end of work area
-
-	e = s[len - 1]; // save end char
-	s[len - 1] = '\0'; // turn end char into null terminator
-
-	while(*s && *s != '<') s++;  // find first tag
-	if(!*s) return ezxml_err(root, s, "root tag missing");
+	ezxml_t cur, prev, head;
 
-	for(; ;)
+	if(!xml) return NULL;  // nothing to do
+	ezxml_index_touch(xml, 0, NULL);
+	if(xml->next)    // patch sibling list
 	{
-		attr = (char **)EZXML_NIL;
-		d = ++s;
+		xml->next->sibling = xml->sibling;
+		EZXML_NODE(xml->next)->tail = EZXML_NODE(xml)->tail; // in case xml is first
+		EZXML_NODE(xml->next)->count = EZXML_NODE(xml)->count - 1;
+		EZXML_NODE(xml->next)->vec = NULL;
+	}
 
-		if(isalpha(*s) || *s == '_' || *s == ':' || *s < '\0')    // new tag
+	if(xml->parent)    // not root tag
+	{
+		cur = xml->parent->child; // find head of subtag list
+		if(cur == xml)    // first subtag
 		{
-			if(!root->cur)
-				return ezxml_err(root, d, "markup outside of root element");
-
-			s += strcspn(s, EZXML_WS "/>");
-			while(isspace(*s)) *(s++) = '\0';  // null terminate tag name
+			ezxml_name_set(xml->parent, xml, xml->next);
+			xml->parent->child = xml->ordered;
+			if(!xml->ordered) EZXML_NODE(xml->parent)->last = NULL;
 
-			if(*s && *s != '/' && *s != '>')  // find tag in default attr list
-				for(i = 0; (a = root->attr[i]) && strcmp(a[0], d); i++);
-
-			for(l = 0; *s && *s != '/' && *s != '>'; l += 2)    // new attrib
+			head = (xml->next) ? xml->next : xml->sibling;
+			if((cur = xml->ordered) && cur != head)    // new first subtag leads
 			{
-				attr = (l) ? realloc(attr, (l + 4) * sizeof(char *))
-				       : malloc(4 * sizeof(char *)); // allocate space
-				attr[l + 3] = (l) ? realloc(attr[l + 1], (l / 2) + 2)
-				              : malloc(2); // mem for list of maloced vals
-				strcpy(attr[l + 3] + (l / 2), " "); // value is not malloced
-				attr[l + 2] = NULL; // null terminate list
-				attr[l + 1] = ""; // temporary attribute value
-				attr[l] = s; // set attribute name
-
-				s += strcspn(s, EZXML_WS "=/>");
-				if(*s == '=' || isspace(*s))
-				{
-					*(s++) = '\0'; // null terminate tag attribute name
-					q = *(s += strspn(s, EZXML_WS "="));
-					if(q == '"' || q == '\'')    // attribute value
-					{
-						attr[l + 1] = ++s;
-						while(*s && *s != q) s++;
-						if(*s) *(s++) = '\0';  // null terminate attribute val
-						else
-						{
-							ezxml_free_attr(attr, MyLibBase);
-							return ezxml_err(root, d, "missing %c", q);
-						}
-
-						for(j = 1; a && a[j] && strcmp(a[j], attr[l]); j += 3);
-						attr[l + 1] = ezxml_decode(attr[l + 1], root->ent, (a
-						                           && a[j]) ? *a[j + 2] : ' ', MyLibBase);
-						if(attr[l + 1] < d || attr[l + 1] > s)
-							attr[l + 3][l / 2] = EZXML_TXTM; // value malloced
-					}
-				}
-				while(isspace(*s)) s++;
+				for(prev = head; prev->sibling != cur; prev = prev->sibling);
+				prev->sibling = cur->sibling;
+				cur->sibling = head;
 			}
+		}
+		else   // not first subtag
+		{
+			while(cur->ordered != xml) cur = cur->ordered;
+			cur->ordered = cur->ordered->ordered; // patch ordered list
+			if(!cur->ordered) EZXML_NODE(xml->parent)->last = cur;
 
-			if(*s == '/')    // self closing tag
+			cur = xml->parent->child; // go back to head of subtag list
+			if(strcmp(cur->name, xml->name))    // not in first sibling list
 			{
-				*(s++) = '\0';
-				if((*s && *s != '>') || (!*s && e != '>'))
+				while(strcmp(cur->sibling->name, xml->name))
+					cur = cur->sibling;
+				if(cur->sibling == xml)    // first of a sibling list
 				{
-					if(l) ezxml_free_attr(attr, MyLibBase);
-					return ezxml_err(root, d, "missing >");
+					ezxml_name_set(xml->parent, xml, xml->next);
+					cur->sibling = (xml->next) ? xml->next
+					               : cur->sibling->sibling;
 				}
-				ezxml_open_tag(root, d, attr, MyLibBase);
-				ezxml_close_tag(root, d, s);
-			}
-			else if((q = *s) == '>' || (!*s && e == '>'))    // open tag
-			{
-				*s = '\0'; // temporarily null terminate tag name
-				ezxml_open_tag(root, d, attr, MyLibBase);
-				*s = q;
-			}
-			else
-			{
-				if(l) ezxml_free_attr(attr, MyLibBase);
-				return ezxml_err(root, d, "missing >");
+				else cur = cur->sibling; // not first of a sibling list
 			}
-		}
-		else if(*s == '/')    // close tag
-		{
-			s += strcspn(d = s + 1, EZXML_WS ">") + 1;
-			if(!(q = *s) && e != '>') return ezxml_err(root, d, "missing >");
-			*s = '\0'; // temporarily null terminate tag name
-			if(ezxml_close_tag(root, d, s)) return &root->xml;
-			if(isspace(*s = q)) s += strspn(s, EZXML_WS);
-		}
-		else if(!strncmp(s, "!--", 3))    // xml comment
-		{
-			if(!(s = strstr(s + 3, "--")) || (*(s += 2) != '>' && *s) ||
-			        (!*s && e != '>')) return ezxml_err(root, d, "unclosed <!--");
-		}
-		else if(!strncmp(s, "![CDATA[", 8))    // cdata
-		{
-			if((s = strstr(s, "]]>")))
-				ezxml_char_content(root, d + 8, (s += 2) - d - 10, 'c', MyLibBase);
-			else return ezxml_err(root, d, "unclosed <![CDATA[");
-		}
-		else if(!strncmp(s, "!DOCTYPE", 8))    // dtd
-		{
-			for(l = 0; *s && ((!l && *s != '>') || (l && (*s != ']' ||
-			                  *(s + strspn(s + 1, EZXML_WS) + 1) != '>')));
-			        l = (*s == '[') ? 1 : l) s += strcspn(s + 1, "[]>") + 1;
-			if(!*s && e != '>')
-				return ezxml_err(root, d, "unclosed <!DOCTYPE");
-			d = (l) ? strchr(d, '[') + 1 : d;
-			if(l && !ezxml_internal_dtd(root, d, s++ - d, MyLibBase)) return &root->xml;
-		}
-		else if(*s == '?')    // <?...?> processing instructions
-		{
-			do
+
+			for(head = cur; cur->next && cur->next != xml; cur = cur->next);
+			if(cur->next)    // patch next list of the first of type
 			{
-				s = strchr(s, '?');
+				cur->next = cur->next->next;
+				EZXML_NODE(head)->count--;
+				if(cur->next) EZXML_NODE(head)->vec = NULL;  // indexes have moved
 			}
-			while(s && *(++s) && *s != '>');
-			if(!s || (!*s && e != '>'))
-				return ezxml_err(root, d, (STRPTR)"unclosed <?");
-			else ezxml_proc_inst(root, d + 1, s - d - 2, MyLibBase);
-		}
-		else return ezxml_err(root, d, "unexpected <");
-
-		if(!s || !*s) break;
-		*s = '\0';
-		d = ++s;
-		if(*s && *s != '<')    // tag character content
-		{
-			while(*s && *s != '<') s++;
-			if(*s) ezxml_char_content(root, d, s - d, '&', MyLibBase);
-			else break;
+			if(EZXML_NODE(head)->tail == xml) EZXML_NODE(head)->tail = cur;
 		}
-		else if(!*s) break;
+		ezxml_stail_set(xml->parent);
 	}
-
-	if(!root->cur) return &root->xml;
-	else if(!root->cur->name) return ezxml_err(root, d, "root tag missing");
-	else return ezxml_err(root, d, "unclosed tag <%s>", root->cur->name);
-}
-
-// Wrapper for ezxml_parse_str() that accepts a file stream. Reads the entire
-// stream into memory and then parses it. For xml files, use ezxml_parse_file()
-// or ezxml_parse_fd()
-ezxml_t ezxml_parse_fp(BPTR fp, struct LibBase *MyLibBase)
-{
-	/* ezxml_root_t root;
-	 ULONG l, len = 0;
-	 char *s;
-
-	 if (!(s = malloc(EZXML_BUFSIZE))) return NULL;
-	 do {
-	     len += (l = FRead(fp, (s + len), EZXML_BUFSIZE, 1));
-	     if (l == EZXML_BUFSIZE) s = realloc(s, len + EZXML_BUFSIZE);   // I think that it's no needed for MorphOS ver. ;-)
-	 } while (s && l == EZXML_BUFSIZE);
-
-	 if (!s) return NULL;
-	 root = (ezxml_root_t)ezxml_parse_str(s, len, MyLibBase);
-	 root->len = -1; // so we know to free s in ezxml_free()
-	 return &root->xml;*/
+	xml->ordered = xml->sibling = xml->next = NULL;
+	EZXML_NODE(xml)->vec = NULL;
+	EZXML_NODE(xml)->count = 1;
+	return xml;
 }
 
-//+ ezxml.library/ezxml_parse_fd
-/****** ezxml.library/ezxml_parse_fd ************************************************
+//+ ezxml.library/ezxml_next
+/****** ezxml.library/ezxml_next ***********************************************
 * NAME
-*  ezxml_parse_fd() - wrapper for ezxml_parse_str() that accepts a file handle (V8)
+*  ezxml_next() - searches for next tag with this same name (V8)
 *
 * SYNOPSIS
-*  ezxml_parse_fd(fd);
-*  ezxml_t ezxml_parse_fd(BPTR);
+*  ezxml_next(xml)
+*  ezxml_t ezxml_next(ezxml_t)
 *
 * FUNCTION
-*  Reads a file handle and parses read data with ezxml_parse_str().
+*  Searches for the next tag of the same name in the same section and depth.
 *
 * INPUTS
-*  fd - file handle returned by dos.library/Open()
+*  xml - ezxml_t structure
 *
 * RESULT
-*	Returns ezxml_t structure or NULL on failure.
-*
-* NOTES
-*  Don't forget to free allocated memory with ezxml_free()
+*	Return a ezxml_t structure of found tag or NULL on failure.
 *
 * SEE ALSO
-*  ezxml_parse_str() ezxml_parse_file() ezxml_free()
-**************************************************************************************
+*  ezxml_child() ezxml_idx()
+********************************************************************************
 *
 */
 //-
-ezxml_t ezxml_parse_fd(BPTR fd, struct LibBase *MyLibBase)
+ezxml_t ezxml_next(ezxml_t xml)
 {
-	ezxml_root_t root;
-	struct FileInfoBlock st;
-	ULONG l;
-	void *m;
-
-	if(fd == NULL) return NULL;
-
-	ExamineFH(fd, &st);
-
-#ifndef EZXML_NOMMAP
-	l = (st.st_size + sysconf(_SC_PAGESIZE) - 1) & ~(sysconf(_SC_PAGESIZE) - 1);
-	if((m = mmap(NULL, l, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) !=
-	        MAP_FAILED)
-	{
-		madvise(m, l, MADV_SEQUENTIAL); // optimize for sequential access
-		root = (ezxml_root_t)ezxml_parse_str(m, st.st_size);
-		madvise(m, root->len = l, MADV_NORMAL); // put it back to normal
-	}
-	else   // mmap failed, read file into memory
-	{
-#endif // EZXML_NOMMAP
-		l = Read(fd, m = malloc(st.fib_Size), st.fib_Size);
-		root = (ezxml_root_t)ezxml_parse_str(m, l, MyLibBase);
-		root->len = -1; // so we know to free s in ezxml_free()
-#ifndef EZXML_NOMMAP
-	}
-#endif // EZXML_NOMMAP
-	return &root->xml;
+	return ((xml) ? xml->next : NULL);
 }
 
-//+ ezxml.library/ezxml_parse_file
-/****** ezxml.library/ezxml_parse_file *******************************************
+//+ ezxml.library/ezxml_name
+/****** ezxml.library/ezxml_name ***********************************************
 * NAME
-*  ezxml_parse_file() - wrapper for ezxml_parse_fd() that accepts a file name (V8)
+*  ezxml_name() - reads name of given tag (V8)
 *
 * SYNOPSIS
-*  ezxml_parse_file(filename);
-*  ezxml_t ezxml_parse_file(CONST_STRPTR file);
+*  ezxml_name(xml)
+*  CONST_STRPTR ezxml_name(ezxml_t)
 *
 * FUNCTION
-*  Opens a file with given filename and passes file pointer to ezxml_parse_fd().
+*  Reads name of given tag from its ezxml_t structure.
 *
 * INPUTS
-*  filename - standard file name (as usually given for dos.library/Open())
+*  xml - ezxml_t structure
 *
 * RESULT
-*	Returns ezxml_t structure or NULL on failure.
+*	Return a pointer to string contains name of given tag.
 *
 * NOTES
-*  Don't forget to free allocated memory with ezxml_free()
+*  Return NULL on failure.
 *
 * SEE ALSO
-*  ezxml_parse_str() ezxml_parse_fd() ezxml_free()
+*  ezxml_txt()
 ********************************************************************************
 *
 */
 //-
-ezxml_t ezxml_parse_file(CONST_STRPTR file, struct LibBase *MyLibBase)
-{
-	int fd = Open(file, MODE_OLDFILE);
-	ezxml_t xml = NULL;
-	if(fd != NULL)
-	{
-		xml = ezxml_parse_fd(fd, MyLibBase);
-		Close(fd);
-	}
-	return xml;
-}
-
-// Encodes ampersand sequences appending the results to *dst, reallocating *dst
-// if length excedes max. a is non-zero for attribute encoding. Returns *dst
-STRPTR ezxml_ampencode(CONST_STRPTR s, ULONG len, STRPTR *dst, ULONG *dlen,
-                       ULONG *max, SHORT a, struct LibBase *MyLibBase)
+STRPTR ezxml_name(ezxml_t xml)
 {
-	const char *e = s + len;
-
-	for(; s != e; s++)
-	{
-		while(*dlen + 10 > *max) *dst = realloc(*dst, *max += EZXML_BUFSIZE);
-
-		switch(*s)
-		{
-		case '\0':
-			return *dst;
-		case '&':
-			*dlen += sprintf(*dst + *dlen, "&amp;");
-			break;
-		case '<':
-			*dlen += sprintf(*dst + *dlen, "&lt;");
-			break;
-		case '>':
-			*dlen += sprintf(*dst + *dlen, "&gt;");
-			break;
-		case '"':
-			*dlen += sprintf(*dst + *dlen, (a) ? "&quot;" : "\"");
-			break;
-		case '\n':
-			*dlen += sprintf(*dst + *dlen, (a) ? "&#xA;" : "\n");
-			break;
-		case '\t':
-			*dlen += sprintf(*dst + *dlen, (a) ? "&#x9;" : "\t");
-			break;
-		case '\r':
-			*dlen += sprintf(*dst + *dlen, "&#xD;");
-			break;
-		default:
-			(*dst)[(*dlen)++] = *s;
-		}
-	}
-	return *dst;
+	return ((xml) ? xml->name : NULL);
 }
 
-// Recursively converts each tag to xml appending it to *s. Reallocates *s if
-// its length excedes max. start is the location of the previous tag in the
-// parent tag's character content. Returns *s.
-STRPTR ezxml_toxml_r(ezxml_t xml, STRPTR *s, ULONG *len, ULONG *max,
-                     ULONG start, STRPTR **attr, struct LibBase *MyLibBase)
-{
-	int i, j;
-	char *txt = (xml->parent) ? xml->parent->txt : "";
-	ULONG off = 0;
-
-	// parent character content up to this tag
-	*s = ezxml_ampencode(txt + start, xml->off - start, s, len, max, 0, MyLibBase);
-
-	while(*len + strlen(xml->name) + 4 > *max)  // reallocate s
-		*s = realloc(*s, *max += EZXML_BUFSIZE);
-
-	*len += sprintf(*s + *len, "<%s", xml->name); // open tag
-	for(i = 0; xml->attr[i]; i += 2)    // tag attributes
-	{
-		if(ezxml_attr(xml, xml->attr[i]) != xml->attr[i + 1]) continue;
-		while(*len + strlen(xml->attr[i]) + 7 > *max)  // reallocate s
-			*s = realloc(*s, *max += EZXML_BUFSIZE);
-
-		*len += sprintf(*s + *len, " %s=\"", xml->attr[i]);
-		ezxml_ampencode(xml->attr[i + 1], -1, s, len, max, 1, MyLibBase);
-		*len += sprintf(*s + *len, "\"");
-	}
-
-	for(i = 0; attr[i] && strcmp(attr[i][0], xml->name); i++);
-	for(j = 1; attr[i] && attr[i][j]; j += 3)    // default attributes
+//+ ezxml.library/ezxml_txt
+/****** ezxml.library/ezxml_txt ***********************************************
+* NAME
+*  ezxml_txt() - reads contents of given tag (V8)
+*
+* SYNOPSIS
+*  ezxml_txt(xml)
+*  CONST_STRPTR ezxml_txt(ezxml_t)
+*
+* FUNCTION
+*  Reads contents of given tag from its ezxml_t structure.
+*
+* INPUTS
+*  xml - ezxml_t structure
+*
+* RESULT
+*	Return a pointer to string contains content of given tag.
+*
+* NOTES
+*  Return empty string ("") on failure.
+*  Text of documents parsed with EZXML_PARSE_LAZY is decoded by the first call
+*  asking for it. Until then the txt field of the tag may hold the raw text.
+*
+* SEE ALSO
+*  ezxml_name()
+********************************************************************************
+*
+*/
+//-
+STRPTR ezxml_txt(ezxml_t xml)
+{
+	if(!xml) return "";
+	if(xml->flags & EZXML_TXTS) ezxml_flatten(xml, EZXML_DOC(xml)->base);  // left by a lazy parse
+	else if(xml->flags & EZXML_TXTD)    // left to decode by a lazy parse
 	{
-		if(!attr[i][j + 1] || ezxml_attr(xml, attr[i][j]) != attr[i][j + 1])
-			continue; // skip duplicates and non-values
-		while(*len + strlen(attr[i][j]) + 7 > *max)  // reallocate s
-			*s = realloc(*s, *max += EZXML_BUFSIZE);
-
-		*len += sprintf(*s + *len, " %s=\"", attr[i][j]);
-		ezxml_ampencode(attr[i][j + 1], -1, s, len, max, 1, MyLibBase);
-		*len += sprintf(*s + *len, "\"");
+		xml->txt = ezxml_decode(xml->txt, &EZXML_DOC(xml)->ent, '&', EZXML_DOC(xml), EZXML_DOC(xml)->base);
+		xml->flags &= ~EZXML_TXTD;
+		EZXML_NODE(xml)->len = strlen(xml->txt);
 	}
-	*len += sprintf(*s + *len, ">");
-
-	*s = (xml->child) ? ezxml_toxml_r(xml->child, s, len, max, 0, attr, MyLibBase) //child
-	     : ezxml_ampencode(xml->txt, -1, s, len, max, 0, MyLibBase);  //data
-
-	while(*len + strlen(xml->name) + 4 > *max)  // reallocate s
-		*s = realloc(*s, *max += EZXML_BUFSIZE);
-
-	*len += sprintf(*s + *len, "</%s>", xml->name); // close tag
-
-	while(txt[off] && off < xml->off) off++;  // make sure off is within bounds
-	return (xml->ordered) ? ezxml_toxml_r(xml->ordered, s, len, max, off, attr, MyLibBase)
-	       : ezxml_ampencode(txt + off, -1, s, len, max, 0, MyLibBase);
+	return xml->txt;
 }
 
-//+ ezxml.library/ezxml_toxml
-/****** ezxml.library/ezxml_toxml *********************************************
+//+ ezxml.library/ezxml_new_d
+/****** ezxml.library/ezxml_new_d **********************************************
 * NAME
-*  ezxml_toxml() - converts an ezxml structure back to xml (V8)
+*  ezxml_new_d() - wrapper for ezxml_new that duplicate name string (V8)
 *
 * SYNOPSIS
-*  ezxml_toxml(xml);
-*  STRPTR ezxml_toxml(ezxml_t);
+*  ezxml_new_d(name);
+*  ezxml_t ezxml_new_d(CONST_STRPTR);
 *
 * FUNCTION
-*  Reads a ezxml_t structure and converts it's to string contains xml data.
+*  Creates a new ezxml_t structure with given root tag name. Name string will be duplicated.
 *
 * INPUTS
-*  xml - ezxml_t structure
+*  name - name of the root tag
 *
 * RESULT
-*	Return a pointer to string contains requested tag.
+*  Returns new ezxml_t structure with given root tag name.
 *
 * NOTES
-*  String have to be freed by calling FreeVec()!
+*  Name will be copied, so you don't have to pay attention for not freeing it too early.
+*
+* SEE ALSO
+*  ezxml_free() ezxml_new()
 ********************************************************************************
 *
 */
 //-
-STRPTR ezxml_toxml(ezxml_t xml, struct LibBase *MyLibBase)
+ezxml_t ezxml_new_d(CONST_STRPTR name, struct LibBase *MyLibBase)
 {
-	ezxml_t p = (xml) ? xml->parent : NULL, o = (xml) ? xml->ordered : NULL;
-	ezxml_root_t root = (ezxml_root_t)xml;
-	ULONG len = 0, max = EZXML_BUFSIZE;
-	char *s = strcpy(malloc(max), ""), *t, *n;
-	int i, j, k;
-
-	if(!xml || !xml->name) return realloc(s, len + 1);
-	while(root->xml.parent) root = (ezxml_root_t)root->xml.parent;  // root tag
-
-	for(i = 0; !p && root->pi[i]; i++)    // pre-root processing instructions
-	{
-		for(k = 2; root->pi[i][k - 1]; k++);
-		for(j = 1; (n = root->pi[i][j]); j++)
-		{
-			if(root->pi[i][k][j - 1] == '>') continue;  // not pre-root
-			while(len + strlen(t = root->pi[i][0]) + strlen(n) + 7 > max)
-				s = realloc(s, max += EZXML_BUFSIZE);
-			len += sprintf(s + len, "<?%s%s%s?>\n", t, *n ? " " : "", n);
-		}
-	}
-
-	xml->parent = xml->ordered = NULL;
-	s = ezxml_toxml_r(xml, &s, &len, &max, 0, root->attr, MyLibBase);
-	xml->parent = p;
-	xml->ordered = o;
-
-	for(i = 0; !p && root->pi[i]; i++)    // post-root processing instructions
-	{
-		for(k = 2; root->pi[i][k - 1]; k++);
-		for(j = 1; (n = root->pi[i][j]); j++)
-		{
-			if(root->pi[i][k][j - 1] == '<') continue;  // not post-root
-			while(len + strlen(t = root->pi[i][0]) + strlen(n) + 7 > max)
-				s = realloc(s, max += EZXML_BUFSIZE);
-			len += sprintf(s + len, "\n<?%s%s%s?>", t, *n ? " " : "", n);
-		}
-	}
-
-	return realloc(s, len + 1);
+	return ezxml_set_flag(ezxml_new(strdup(name), MyLibBase), EZXML_NAMEM);
 }
-
-//+ ezxml.library/ezxml_free
-/****** ezxml.library/ezxml_free ***********************************************
+//+ ezxml.library/ezxml_add_child_d
+/****** ezxml.library/ezxml_add_child_d *****************************************
 * NAME
-*  ezxml_free() - frees the memory allocated for an ezxml structure (V8)
+*  ezxml_add_child_d() - wrapper for ezxml_add_child that duplicate name string (V8)
 *
 * SYNOPSIS
-*  ezxml_free(xml);
-*  VOID ezxml_free(ezxml_t);
+*  ezxml_add_child_d(xml, name, off);
+*  ezxml_t ezxml_add_child_d(ezxml_t, CONST_STRPTR, ULONG);
 *
 * FUNCTION
-*  Frees the memory allocated for an ezxml structure. When you call it for structure,
-*  which have subtags, etc. it will automatically free any child.
+*  Adds a child to given tag with specified name. Off is the offset of the child tag
+*  relative to the start of the parent tag's character content.
 *
 * INPUTS
-*  xml - ezxml_t tag structure
+*  xml  - ezxml_t structure of parents' tag
+*  name - name of the child tag
+*  off  - offset of the child tag relative to the start of the parent tag's character content
+*
+* RESULT
+*  Returns the child tag.
+*
+* NOTES
+*  Name will be copied, so you don't have to pay attention for not freeing it too early.
 *
 * SEE ALSO
-*  ezxml_parse_str() ezxml_parse_fd() ezxml_parse_file() ezxml_new()
+*  ezxml_free() ezxml_new() ezxml_add_child()
 ********************************************************************************
 *
 */
 //-
-VOID ezxml_free(ezxml_t xml, struct LibBase *MyLibBase)
+ezxml_t ezxml_add_child_d(ezxml_t xml, CONST_STRPTR name, ULONG off, struct LibBase *MyLibBase)
 {
-	ezxml_root_t root = (ezxml_root_t)xml;
-	int i, j;
-	char **a, *s;
-
-	if(!xml) return;
-	ezxml_free(xml->child, MyLibBase);
-	ezxml_free(xml->ordered, MyLibBase);
-
-	if(!xml->parent)    // free root tag allocations
-	{
-		for(i = 10; root->ent[i]; i += 2)  // 0 - 9 are default entites (<>&"')
-			if(((s = root->ent[i + 1]) < root->s || s > root->e) && s) free(s);
-		if(root->ent)free(root->ent); // free list of general entities
-
-		for(i = 0; (a = root->attr[i]); i++)
-		{
-			for(j = 1; a[j++]; j += 2)  // free malloced attribute values
-				if(a[j] && (a[j] < root->s || a[j] > root->e)) free(a[j]);
-			if(a) free(a);
-		}
-		if(root->attr[0] && root->attr) free(root->attr);  // free default attribute list
-
-		for(i = 0; root->pi[i]; i++)
-		{
-			for(j = 1; root->pi[i][j]; j++);
-			if(root->pi[i][j + 1])free(root->pi[i][j + 1]);
-			if(root->pi[i]) free(root->pi[i]);
-		}
-		if(root->pi[0] && root->pi) free(root->pi);  // free processing instructions
-
-		if(root->len == -1 && root->m) free(root->m);  // malloced xml data
-#ifndef EZXML_NOMMAP
-		else if(root->len) munmap(root->m, root->len);  // mem mapped xml data
-#endif /* EZXML_NOMMAP */
-		if(root->u) free(root->u);  // utf8 conversion
-	}
-
-	ezxml_free_attr(xml->attr, MyLibBase); // tag attributes
-	if((xml->flags & EZXML_TXTM) && xml->txt) free(xml->txt);  // character content
-	if((xml->flags & EZXML_NAMEM) && xml->name) free(xml->name);  // tag name
-	if(xml) free(xml);
+	return ezxml_set_flag(ezxml_add_child(xml, strdup(name), off, MyLibBase), EZXML_NAMEM);
 }
-
-//+ ezxml.library/ezxml_error
-/****** ezxml.library/ezxml_error ***********************************************
+//+ ezxml.library/ezxml_set_text_d
+/****** ezxml.library/ezxml_set_text_d ********************************************
 * NAME
-*  ezxml_error() - reads error message (V8)
+*  ezxml_set_text_d() - wrapper for ezxml_set_text() that duplicate content string (V8)
 *
 * SYNOPSIS
-*  ezxml_error(xml);
-*  CONST_STRPTR ezxml_error(ezxml_t);
+*  ezxml_set_txt_d(xml, txt);
+*  ezxml_t ezxml_set_txt_d(ezxml_t, CONST_STRPTR);
 *
 * FUNCTION
-*  Reads error messages from ezxml_t structure.
+*  Sets the content of the given tag with copy the txt string.
 *
 * INPUTS
-*  xml - ezxml_t tag structure
+*  xml - ezxml_t structure of tag
+*  txt - contents to be placed in tag
 *
 * RESULT
-*  Returns pointer to string contains error message.
+*  Returns the tag.
+*
+* NOTES
+*  Txt will be copied, so you don't have to pay attention for not freeing it too early.
 *
 * SEE ALSO
-*  ezxml_parse_str() ezxml_parse_fd() ezxml_parse_file()
+*  ezxml_free() ezxml_set_text() ezxml_set_attr() ezxml_set_flag()
 ********************************************************************************
 *
 */
 //-
-CONST_STRPTR ezxml_error(ezxml_t xml)
+ezxml_t ezxml_set_txt_d(ezxml_t xml, CONST_STRPTR txt, struct LibBase *MyLibBase)
 {
-	while(xml && xml->parent) xml = xml->parent;  // find root tag
-	return (xml) ? ((ezxml_root_t)xml)->err : "";
+	return ezxml_set_flag(ezxml_set_txt(xml, strdup(txt), MyLibBase), EZXML_TXTM);
 }
-
-//+ ezxml.library/ezxml_new
-/****** ezxml.library/ezxml_new *************************************************
+//+ ezxml.library/ezxml_set_attr_d
+/****** ezxml.library/ezxml_set_attr_d *****************************************
 * NAME
-*  ezxml_new() - creates a new ezxml_t structure (V8)
+*  ezxml_set_attr_d() - wrapper for ezxml_set_attr() that duplicate name and value (V8)
 *
 * SYNOPSIS
-*  ezxml_new(name);
-*  ezxml_t ezxml_new(CONST_STRPTR);
+*  ezxml_set_attr_d(xml, name, value);
+*  ezxml_t ezxml_set_attr_d(ezxml_t, CONST_STRPTR, CONST_STRPTR);
 *
 * FUNCTION
-*  Creates a new ezxml_t structure with given root tag name.
+*  Sets the given tag attribute or creates a new attribute if not found.
+*  Name and value will be duplicated.
 *
 * INPUTS
-*  name - name of the root tag
+*  xml - ezxml_t structure of tag
+*  name - name of attribute
+*  value - value of attribute
 *
 * RESULT
-*  Returns new ezxml_t structure with given root tag name.
+*  Returns the tag given.
 *
 * NOTES
-*  Name won't be copied. Please pay attention for not freeing it to early or use ezxml_new_d().
-*  For full compatibility with ezxml_free() please use AllocVec() to alloc memory for
-*  name string.
+*  Value cannot be NULL, so for deleting attribute you have to use ezxml_set_attr().
 *
 * SEE ALSO
-*  ezxml_free() ezxml_new_d()
+*  ezxml_free() ezxml_set_text() ezxml_set_attr() ezxml_set_flag()
 ********************************************************************************
 *
 */
 //-
-ezxml_t ezxml_new(CONST_STRPTR name, struct LibBase *MyLibBase)
+ezxml_t ezxml_set_attr_d(ezxml_t xml, CONST_STRPTR name, CONST_STRPTR value, struct LibBase *MyLibBase)
 {
-	static char *ent[] = { "lt;", "&#60;", "gt;", "&#62;", "quot;", "&#34;",
-	                       "apos;", "&#39;", "amp;", "&#38;", NULL
-	                     };
-	ezxml_root_t root = (ezxml_root_t)memset(malloc(sizeof(struct ezxml_root)),
-	                    '\0', sizeof(struct ezxml_root));
-	root->xml.name = (char *)name;
-	root->cur = &root->xml;
-	strcpy(root->err, root->xml.txt = "");
-	root->ent = memcpy(malloc(sizeof(ent)), ent, sizeof(ent));
-	root->attr = root->pi = (char ***)(root->xml.attr = EZXML_NIL);
-	return &root->xml;
+	return ezxml_set_attr(ezxml_set_flag(xml, EZXML_DUP), strdup(name),
+	                      (value) ? strdup(value) : NULL, MyLibBase);
 }
-
-//+ ezxml.library/ezxml_insert
-/****** ezxml.library/ezxml_insert **********************************************
+//+ ezxml.library/ezxml_move
+/****** ezxml.library/ezxml_move **********************************************
 * NAME
-*  ezxml_insert() - inserts an existing tag (V8)
+*  ezxml_move() - moves an existing tag (V8)
 *
 * SYNOPSIS
-*  ezxml_insert(xml, dest, off);
-*  ezxml_t ezxml_insert(ezxml_t, ezxml_t, ULONG);
+*  ezxml_move(xml, dest, off);
+*  ezxml_t ezxml_move(ezxml_t, ezxml_t, ULONG);
 *
 * FUNCTION
-*  Inserts an exisiting tag into ezxml_t structure.
+*  Moves an existing tag to become a subtag of dest tag at the
+*  given offset from the start of dest's character content.
 *
 * INPUTS
 *  xml  - source ezxml_t structure
@@ -1479,590 +5010,1437 @@ ezxml_t ezxml_new(CONST_STRPTR name, struct LibBase *MyLibBase)
 *  off  - offset
 *
 * RESULT
-*  Returns the tag.
+*  Returns the moved tag.
 *
 * SEE ALSO
-*  ezxml_move()
+*  ezxml_insert()
 ********************************************************************************
 *
 */
 //-
-ezxml_t ezxml_insert(ezxml_t xml, ezxml_t dest, ULONG off)
+ezxml_t ezxml_move(ezxml_t xml, ezxml_t dest, ULONG off)
 {
-	ezxml_t cur, prev, head;
-
-	xml->next = xml->sibling = xml->ordered = NULL;
-	xml->off = off;
-	xml->parent = dest;
-
-	if((head = dest->child))    // already have sub tags
-	{
-		if(head->off <= off)    // not first subtag
-		{
-			for(cur = head; cur->ordered && cur->ordered->off <= off;
-			        cur = cur->ordered);
-			xml->ordered = cur->ordered;
-			cur->ordered = xml;
-		}
-		else   // first subtag
-		{
-			xml->ordered = head;
-			dest->child = xml;
-		}
-
-		for(cur = head, prev = NULL; cur && strcmp(cur->name, xml->name);
-		        prev = cur, cur = cur->sibling); // find tag type
-		if(cur && cur->off <= off)    // not first of type
-		{
-			while(cur->next && cur->next->off <= off) cur = cur->next;
-			xml->next = cur->next;
-			cur->next = xml;
-		}
-		else   // first tag of this type
-		{
-			if(prev && cur) prev->sibling = cur->sibling;  // remove old first
-			xml->next = cur; // old first tag is now next
-			for(cur = head, prev = NULL; cur && cur->off <= off;
-			        prev = cur, cur = cur->sibling); // new sibling insert point
-			xml->sibling = cur;
-			if(prev) prev->sibling = xml;
-		}
-	}
-	else dest->child = xml; // only sub tag
-
-	return xml;
+	return ezxml_insert(ezxml_cut(xml), dest, off);
 }
-
-//+ ezxml.library/ezxml_add_child
-/****** ezxml.library/ezxml_add_child *****************************************
+//+ ezxml.library/ezxml_remove
+/****** ezxml.library/ezxml_remove **********************************************
 * NAME
-*  ezxml_add_child() - adds a child tag (V8)
+*  ezxml_remove() - wrapper for ezxml_cut() and ezxml_free() (V8)
 *
 * SYNOPSIS
-*  ezxml_add_child(xml, name, off);
-*  ezxml_t ezxml_add_child(ezxml_t, CONST_STRPTR, ULONG);
+*  ezxml_remove(xml);
+*  VOID ezxml_move(ezxml_t);
 *
 * FUNCTION
-*  Adds a child to given tag with specified name. Off is the offset of the child tag
-*  relative to the start of the parent tag's character content.
+*  Removes a tag along with its subtag with freeing the memory.
 *
 * INPUTS
-*  xml  - ezxml_t structure of parents' tag
-*  name - name of the child tag
-*  off  - offset of the child tag relative to the start of the parent tag's character content
-*
-* RESULT
-*  Returns the child tag.
+*  xml - ezxml_t structure do be removed
 *
 * NOTES
-*  Name won't be copied. Please pay attention for not freeing it to early or use ezxml_add_child_d().
-*  For full compatibility with ezxml_free() please use AllocVec() to alloc memory for name string.
+*  Only strings the tags own are freed at once. The tags themselves go back
+*  when their document is freed, see ezxml_free().
 *
 * SEE ALSO
-*  ezxml_free() ezxml_new() ezxml_add_child_d()
+*  ezxml_free() ezxml_cut()
 ********************************************************************************
 *
 */
 //-
-ezxml_t ezxml_add_child(ezxml_t xml, CONST_STRPTR name, ULONG off, struct LibBase *MyLibBase)
+void ezxml_remove(ezxml_t xml, struct LibBase *MyLibBase)
 {
-	ezxml_t child;
-
-	if(!xml) return NULL;
-	child = (ezxml_t)memset(malloc(sizeof(struct ezxml)), '\0',
-	                        sizeof(struct ezxml));
-	child->name = (char *)name;
-	child->attr = EZXML_NIL;
-	child->txt = "";
-
-	return ezxml_insert(child, xml, off);
+	ezxml_free(ezxml_cut(xml), MyLibBase);
 }
 
-//+ ezxml.library/ezxml_set_text
-/****** ezxml.library/ezxml_set_text ********************************************
+//+ ezxml.library/ezxml_iter_init
+/****** ezxml.library/ezxml_iter_init ******************************************
 * NAME
-*  ezxml_set_text() - sets the character content for the given tag (V8)
+*  ezxml_iter_init() - starts a walk through a tree (V9)
 *
 * SYNOPSIS
-*  ezxml_set_txt(xml, txt);
-*  ezxml_t ezxml_set_txt(ezxml_t, CONST_STRPTR);
+*  ezxml_iter_init(it, xml)
+*  VOID ezxml_iter_init(struct ezxml_iter *, ezxml_t)
 *
 * FUNCTION
-*  Sets the content of the given tag.
+*  Prepares iterator it to walk through tag xml and all its subtags in document
+*  order, the order their start tags appear in the source.
 *
 * INPUTS
-*  xml - ezxml_t structure of tag
-*  txt - contents to be placed in tag
-*
-* RESULT
-*  Returns the tag.
+*  it - iterator, usually a local variable
+*  xml - ezxml_t structure
 *
 * NOTES
-*  Txt won't be copied. Please pay attention for not freeing it to early or use ezxml_set_text_d().
-*  For full compatibility with ezxml_free() please use AllocVec() to alloc memory for txt string.
+*  The walk uses no memory besides the iterator and no recursion, whatever the
+*  depth of the tree.
+*
+* EXAMPLE
+*  struct ezxml_iter it;
+*
+*  ezxml_iter_init(&it, xml);
+*  while((tag = ezxml_iter_next(&it))) ...
 *
 * SEE ALSO
-*  ezxml_free() ezxml_set_text_d() ezxml_set_attr() ezxml_set_flag()
+*  ezxml_iter_next() ezxml_iter_skip_subtree() ezxml_foreach()
 ********************************************************************************
 *
 */
 //-
-ezxml_t ezxml_set_txt(ezxml_t xml, CONST_STRPTR txt, struct LibBase *MyLibBase)
+VOID ezxml_iter_init(struct ezxml_iter *it, ezxml_t xml)
 {
-	if(!xml) return NULL;
-	if(xml->flags & EZXML_TXTM) free(xml->txt);  // existing txt was malloced
-	xml->flags &= ~EZXML_TXTM;
-	xml->txt = (char *)txt;
-	return xml;
+	it->top = xml;
+	it->cur = NULL;
+	it->depth = 0;
+	it->skip = FALSE;
 }
 
-//+ ezxml.library/ezxml_set_attr
-/****** ezxml.library/ezxml_set_attr ********************************************
+//+ ezxml.library/ezxml_iter_next
+/****** ezxml.library/ezxml_iter_next ******************************************
 * NAME
-*  ezxml_set_attr() - sets the given tag attribute (V8)
+*  ezxml_iter_next() - steps to the next tag of a walk (V9)
 *
 * SYNOPSIS
-*  ezxml_set_attr(xml, name, value);
-*  ezxml_t ezxml_set_attr(ezxml_t, CONST_STRPTR, CONST_STRPTR);
+*  ezxml_iter_next(it)
+*  ezxml_t ezxml_iter_next(struct ezxml_iter *)
 *
 * FUNCTION
-*  Sets the given tag attribute or creates a new attribute if not found.
-*  A value of NULL will remove the specified attribute.
+*  Returns the next tag of the walk, the tag given to ezxml_iter_init() on the
+*  first call. The depth field of the iterator holds the number of tags between
+*  the one returned and that tag.
 *
 * INPUTS
-*  xml - ezxml_t structure of tag
-*  name - name of attribute
-*  value - value of attribute
+*  it - iterator prepared by ezxml_iter_init()
 *
 * RESULT
-*  Returns the tag given.
+*	Returns the next tag, NULL when all tags have been walked through.
 *
 * NOTES
-*  Name and value won't be copied. So pay attention for not freeing it too early.
-*  For full compatibility with ezxml_free() please use AllocVec() to alloc memory for strings.
+*  Takes constant time per tag on average. The tags returned may be changed, but
+*  not cut, removed or moved before the walk goes past them.
 *
 * SEE ALSO
-*  ezxml_free() ezxml_set_text() ezxml_set_attr_d() ezxml_set_flag()
+*  ezxml_iter_init() ezxml_iter_skip_subtree()
 ********************************************************************************
 *
 */
 //-
-ezxml_t ezxml_set_attr(ezxml_t xml, CONST_STRPTR name, CONST_STRPTR value, struct LibBase* MyLibBase)
+ezxml_t ezxml_iter_next(struct ezxml_iter *it)
 {
-	int l = 0, c;
-
-	if(!xml) return NULL;
-
-	while(xml->attr[l] && strcmp(xml->attr[l], name)) l += 2;
-	if(!xml->attr[l])    // not found, add as new attribute
-	{
-		if(!value) return xml;  // nothing to do
-		if(xml->attr == EZXML_NIL)    // first attribute
-		{
-			xml->attr = malloc(4 * sizeof(char *));
-			xml->attr[1] = strdup(""); // empty list of malloced names/vals
-		}
-		else xml->attr = realloc(xml->attr, (l + 4) * sizeof(char *));
-
-		xml->attr[l] = (char *)name; // set attribute name
-		xml->attr[l + 2] = NULL; // null terminate attribute list
-		if(xml->attr[l + 1]) xml->attr[l + 3] = realloc(xml->attr[l + 1], (c = strlen(xml->attr[l + 1])) + 2);
-	}
-	else if(xml->flags & EZXML_DUP) free((char *)name);  // name was strduped
-
-	for(c = l; xml->attr[c]; c += 2);  // find end of attribute list
-	if(xml->attr[l + 1] && xml->attr[c + 1][l / 2] && xml->attr[c + 1][l / 2] & EZXML_TXTM) free(xml->attr[l + 1]); //old val
-	if(!(xml->flags & EZXML_DUP))
-	{
-		xml->attr[c + 1][l / 2] &= ~EZXML_TXTM;
-	}
+	ezxml_t xml = it->cur;
 
-	if(value)
+	if(!it->top) return NULL;    // done
+	if(!xml) xml = it->top;
+	else if(xml->child && !it->skip)
 	{
-		xml->attr[l + 1] = (char *)value; // set attribute value
+		xml = xml->child;
+		it->depth++;
 	}
-	else   // remove attribute
+	else
 	{
-		if(xml->attr[c + 1][l / 2] & EZXML_NAMEM) free(xml->attr[l]);
-		memmove(xml->attr + l, xml->attr + l + 2, (c - l + 2) * sizeof(char*));
-		xml->attr = realloc(xml->attr, (c + 2) * sizeof(char *));
+		for(; xml != it->top && !xml->ordered; xml = xml->parent) it->depth--;
+		if(xml == it->top) it->top = xml = NULL;    // end of the walk
+		else xml = xml->ordered;
 	}
-	xml->flags &= ~EZXML_DUP; // clear strdup() flag
-	return xml;
+	it->skip = FALSE;
+	return (it->cur = xml);
 }
 
-//+ ezxml.library/ezxml_set_flag
-/****** ezxml.library/ezxml_set_flag *****************************************
+//+ ezxml.library/ezxml_iter_skip_subtree
+/****** ezxml.library/ezxml_iter_skip_subtree **********************************
 * NAME
-*  ezxml_set_flag() - sets the flag for the given tag (V8)
+*  ezxml_iter_skip_subtree() - skips the subtags of the current tag (V9)
 *
 * SYNOPSIS
-*  ezxml_set_flag(xml, flag);
-*  ezxml_t ezxml_set_flag(ezxml_t, SHORT);
+*  ezxml_iter_skip_subtree(it)
+*  VOID ezxml_iter_skip_subtree(struct ezxml_iter *)
 *
 * FUNCTION
-*  Sets a flag for the given tag.
+*  Makes the next call of ezxml_iter_next() go past the subtags of the tag it
+*  returned last.
 *
 * INPUTS
-*  xml  - ezxml_t structure of tag
-*  flag - flag to be set
-*
-* RESULT
-*  Returns the tag given.
+*  it - iterator prepared by ezxml_iter_init()
 *
 * SEE ALSO
-*  ezxml_set_text() ezxml_set_attr_d() ezxml_set_flag()
+*  ezxml_iter_next()
 ********************************************************************************
 *
 */
 //-
-ezxml_t ezxml_set_flag(ezxml_t xml, SHORT flag)
+VOID ezxml_iter_skip_subtree(struct ezxml_iter *it)
 {
-	if(xml) xml->flags |= flag;
-	return xml;
+	it->skip = TRUE;
 }
 
-//+ ezxml.library/ezxml_cut
-/****** ezxml.library/ezxml_cut ***********************************************
+// Returns the end of the name starting at s.
+static STRPTR ezxml_query_name(STRPTR s)
+{
+	while(*s && !strchr("/[]()@=!<>'\"\t\r\n ", *s)) s++;
+	return s;
+}
+
+// Parses the predicate following the '[' at s. Returns a pointer to the byte
+// following its ']', NULL on a syntax error. Names and literals are terminated
+// in place.
+static STRPTR ezxml_query_pred(STRPTR s, struct ezxml_pred *p)
+{
+	STRPTR e;
+
+	s += strspn(s, EZXML_WS);
+	if(isdigit((UBYTE)*s))    // position
+	{
+		p->type = EZXML_Q_POS;
+		if(!(p->pos = strtoul(s, (char **)&s, 10))) return NULL;
+		e = s;
+	}
+	else if(!strncmp(s, "last()", 6))
+	{
+		p->type = EZXML_Q_LAST;
+		e = s += 6;
+	}
+	else
+	{
+		if(*s == '@') p->name = ++s, p->type = EZXML_Q_ATTR;
+		else if(!strncmp(s, "text()", 6)) s += 6, p->type = EZXML_Q_TXT;
+		else if(*s == '.') s++, p->type = EZXML_Q_TXT;
+		else p->name = s, p->type = EZXML_Q_SUB;
+		if(p->name && (s = ezxml_query_name(s)) == p->name) return NULL;
+
+		s += strspn(e = s, EZXML_WS);
+		if(*s == '=') p->op = EZXML_Q_EQ;
+		else if(*s == '!' && s[1] == '=') p->op = EZXML_Q_NE, s++;
+		else if(*s == '<') p->op = (s[1] == '=') ? (s++, EZXML_Q_LE) : EZXML_Q_LT;
+		else if(*s == '>') p->op = (s[1] == '=') ? (s++, EZXML_Q_GE) : EZXML_Q_GT;
+
+		if(p->op)    // comparison with a literal
+		{
+			*e = '\0';    // terminates the name
+			s++;
+			s += strspn(s, EZXML_WS);
+			if(*s == '"' || *s == '\'')
+			{
+				p->str = TRUE;
+				p->lit = s + 1;
+				if(!(s = strchr(p->lit, *s))) return NULL;    // unterminated
+				*(s++) = '\0';
+				p->val = strtod(p->lit, (char **)&e);
+				p->num = (e != p->lit && !e[strspn(e, EZXML_WS)]);
+			}
+			else
+			{
+				p->val = strtod(s, (char **)&e);
+				if(e == s) return NULL;    // neither a string nor a number
+				p->num = TRUE;
+				s = e;
+			}
+			e = s;
+		}
+	}
+
+	s += strspn(s, EZXML_WS);
+	if(*s != ']') return NULL;
+	*e = '\0';    // terminates a name ending the predicate
+	return s + 1;
+}
+
+//+ ezxml.library/ezxml_query_compile
+/****** ezxml.library/ezxml_query_compile **************************************
 * NAME
-*  ezxml_cut() - removes a tag along with its subtags (V8)
+*  ezxml_query_compile() - compiles a path expression (V9)
 *
 * SYNOPSIS
-*  ezxml_cut(xml);
-*  ezxml_t ezxml_cut(ezxml_t);
+*  ezxml_query_compile(path)
+*  ezxml_query_t ezxml_query_compile(CONST_STRPTR)
 *
 * FUNCTION
-*  Removes a tag along with its subtags.
+*  Compiles a path expression, a subset of XPath, into a query which can be
+*  executed any number of times on any number of documents.
+*
+*  The path is a list of steps separated by '/'. A step is a tag name, '*' for
+*  tags of any name, '.' for the context tag itself or '..' for its parent.
+*  A path starting with '/' starts at the document, others at the tag the query
+*  is executed on. A step following '//' instead of '/' applies to all
+*  descendants of the tags selected so far.
+*
+*  Each step may be followed by any number of predicates in square brackets,
+*  applied in order to the tags the step selects from each context tag:
+*   [3]               third tag, counting from 1
+*   [last()]          last tag
+*   [@attr]           tags having the attribute
+*   [@attr op lit]    tags having the attribute with a matching value
+*   [name]            tags having a subtag of that name
+*   [name op lit]     tags having a subtag of that name with matching content
+*   [text() op lit]   tags with matching character content, [. op lit] alike
+*  where op is one of '=', '!=', '<', '<=', '>' and '>=' and lit is a number or
+*  a string in single or double quotes. Values compared to a number, or related
+*  by '<', '<=', '>' or '>=' to a string holding a number, compare as numbers.
 *
 * INPUTS
-*  xml - ezxml_t structure of tag to be cut
+*  path - path expression, e.g. "/formula1/team[@name='McLaren']/driver[points>100]/name"
 *
 * RESULT
-*  Returns the tag given.
+*	Returns the compiled query, NULL on a syntax error or if out of memory.
 *
 * NOTES
-*  This function does not freeing memory!
+*  The query does not reference the path, which may be freed right away.
 *
 * SEE ALSO
-*  ezxml_remove() ezxml_free()
+*  ezxml_query_exec() ezxml_query_free() ezxml_get()
 ********************************************************************************
 *
 */
 //-
-ezxml_t ezxml_cut(ezxml_t xml)
+ezxml_query_t ezxml_query_compile(CONST_STRPTR path, struct LibBase *MyLibBase)
 {
-	ezxml_t cur;
+	struct ezxml_query *q;
+	struct ezxml_step *t;
+	struct ezxml_pred *p;
+	CONST_STRPTR c;
+	STRPTR s, e;
+	ULONG n = 1, m = 0, l;
+
+	if(!path) return NULL;
+	for(c = path; *c; c++)    // bound the numbers of steps and predicates
+	{
+		if(*c == '/') n++;
+		else if(*c == '[') m++;
+	}
+	l = c - path;
+
+	if(!(q = malloc(EZXML_ALIGN(sizeof(struct ezxml_query)) + EZXML_ALIGN(n * sizeof(struct ezxml_step)) +
+	                m * sizeof(struct ezxml_pred) + l + 1))) return NULL;
+	q->step = (struct ezxml_step *)((UBYTE *)q + EZXML_ALIGN(sizeof(struct ezxml_query)));
+	p = (struct ezxml_pred *)((UBYTE *)q->step + EZXML_ALIGN(n * sizeof(struct ezxml_step)));
+	s = (STRPTR)(p + m);
+	memcpy(s, path, l + 1);
+
+	q->abs = (*s == '/');
+	for(t = q->step, l = *s; ; t++)    // l is the separator preceding step t
+	{
+		if(l == '/' && *(++s) == '/') t->desc = TRUE, s++;
+		t->pred = p;
+
+		if(*s == '*') s++, t->axis = EZXML_Q_CHILD;
+		else if(*s == '.' && s[1] == '.') s += 2, t->axis = EZXML_Q_UP;
+		else if(*s == '.') s++, t->axis = EZXML_Q_SELF;
+		else if((s = ezxml_query_name(t->name = s)) != t->name) t->axis = EZXML_Q_CHILD;
+		else break;    // step missing
+
+		for(e = s; *s == '['; t->npred++)
+			if(!(s = ezxml_query_pred(s + 1, p++))) break;
+		if(!s || ((l = *s) && l != '/')) break;
+		*e = '\0';    // terminates the name of the step
+
+		q->nstep++;
+		if(!l) return q;
+	}
+
+	free(q);    // syntax error
+	return NULL;
+}
+
+// Makes room for n more tags in set. Returns FALSE if out of memory.
+static BOOL ezxml_qset_room(struct ezxml_qset *set, ULONG n, struct LibBase *MyLibBase)
+{
+	ezxml_t *x;
+	ULONG max;
+
+	if(set->n + n <= set->max) return TRUE;
+	for(max = (set->max) ? set->max : EZXML_QSET; max < set->n + n; max *= 2);
+	x = (set->x) ? realloc(set->x, max * sizeof(ezxml_t)) : malloc(max * sizeof(ezxml_t));
+	if(!x) return FALSE;
+	set->x = x;
+	set->max = max;
+	return TRUE;
+}
+
+// Appends xml to set. Returns FALSE if out of memory.
+static inline BOOL ezxml_qset_add(struct ezxml_qset *set, ezxml_t xml, struct LibBase *MyLibBase)
+{
+	if(set->n == set->max && !ezxml_qset_room(set, 1, MyLibBase)) return FALSE;
+	set->x[set->n++] = xml;
+	return TRUE;
+}
+
+// Compares value v with the literal of predicate p. Returns TRUE if they match.
+static BOOL ezxml_query_cmp(CONST_STRPTR v, struct ezxml_pred *p)
+{
+	BOOL num = p->num && (!p->str || p->op > EZXML_Q_NE);
+	DOUBLE d = 0;
+	STRPTR e;
+	LONG c;
+
+	if(!p->op) return TRUE;    // test of existence
+	if(num)
+	{
+		d = strtod(v, (char **)&e);
+		if(e == v || e[strspn(e, EZXML_WS)] || d != d)    // not a number
+		{
+			if(!p->str) return (p->op == EZXML_Q_NE);
+			num = FALSE;    // relate as strings
+		}
+	}
+	c = (num) ? ((d < p->val) ? -1 : (d > p->val)) : strcmp(v, p->lit);
+
+	switch(p->op)
+	{
+		case EZXML_Q_EQ: return (c == 0);
+		case EZXML_Q_NE: return (c != 0);
+		case EZXML_Q_LT: return (c < 0);
+		case EZXML_Q_LE: return (c <= 0);
+		case EZXML_Q_GT: return (c > 0);
+		default:         return (c >= 0);
+	}
+}
+
+// Returns TRUE if the content of tag xml is still to be decoded or flattened.
+static inline BOOL ezxml_txt_lazy(ezxml_t xml)
+{
+	return (xml->flags & (EZXML_TXTS | EZXML_TXTD)) != 0;
+}
+
+// Returns TRUE if tag xml passes predicate p, which is not a positional one.
+// If lazy is given the tree is only read, values still to be decoded set it.
+static BOOL ezxml_query_test(ezxml_t xml, struct ezxml_pred *p, UBYTE *lazy, struct LibBase *MyLibBase)
+{
+	CONST_STRPTR v;
+	ezxml_t c;
+
+	if(!xml) return FALSE;    // the document has neither attributes nor content
+	switch(p->type)
+	{
+		case EZXML_Q_ATTR:
+			if(lazy && (EZXML_DOC(xml)->mode & EZXML_PARSE_LAZY)) *lazy = TRUE;
+			else return ((v = ezxml_attr(xml, p->name)) && ezxml_query_cmp(v, p));
+			return FALSE;
+		case EZXML_Q_TXT:
+			if(lazy && ezxml_txt_lazy(xml)) *lazy = TRUE;
+			else return ezxml_query_cmp(ezxml_txt(xml), p);
+			return FALSE;
+		default:
+			for(c = (lazy) ? ezxml_name_peek(xml, p->name) : ezxml_name_get(xml, p->name); c; c = c->next)
+			{
+				if(lazy && ezxml_txt_lazy(c)) *lazy = TRUE;
+				else if(ezxml_query_cmp(ezxml_txt(c), p)) return TRUE;
+			}
+			return FALSE;
+	}
+}
+
+// Appends the tags step t selects from tag xml to set, NULL standing for the
+// document having top as its root tag. Returns FALSE if out of memory. If
+// set->ro is set, the tree is only read and FALSE is returned as well if a value
+// still to be decoded was met.
+static BOOL ezxml_query_step(ezxml_t xml, ezxml_t top, struct ezxml_step *t, struct ezxml_qset *set,
+                             struct LibBase *MyLibBase)
+{
+	struct ezxml_pred *p = t->pred;
+	ULONG i, j, n = set->n;
+	BOOL one = TRUE;    // step selects a single candidate, c
+	ezxml_t *x, c = NULL;
+
+	if(t->axis == EZXML_Q_SELF) c = xml;
+	else if(t->axis == EZXML_Q_UP)
+	{
+		if((one = (xml != NULL))) c = xml->parent;    // parent of top is the document
+	}
+	else if(!xml)
+	{
+		if((one = (!t->name || !strcmp(t->name, top->name)))) c = top;
+	}
+	else if(t->name && t->npred && p->type == EZXML_Q_POS && !set->ro)    // [n] needs no list
+	{
+		one = ((c = ezxml_idx(ezxml_name_get(xml, t->name), p->pos - 1)) != NULL);
+		p++;
+	}
+	else    // list of subtags
+	{
+		one = FALSE;
+		c = (!t->name) ? xml->child : (set->ro) ? ezxml_name_peek(xml, t->name) : ezxml_name_get(xml, t->name);
+		for(; c; c = (t->name) ? c->next : c->ordered)
+			if(!ezxml_qset_add(set, c, MyLibBase)) return FALSE;
+	}
+	if(one && !ezxml_qset_add(set, c, MyLibBase)) return FALSE;
+
+	for(; p < t->pred + t->npred; p++)    // filter the candidates in place
+	{
+		x = set->x + n;
+		j = set->n - n;
+		if(p->type == EZXML_Q_POS)
+		{
+			if(p->pos <= j) x[0] = x[p->pos - 1];
+			set->n = n + (p->pos <= j);
+		}
+		else if(p->type == EZXML_Q_LAST)
+		{
+			if(j) x[0] = x[j - 1];
+			set->n = n + (j > 0);
+		}
+		else
+		{
+			for(i = j = 0; i < set->n - n; i++)
+				if(ezxml_query_test(x[i], p, (set->ro) ? &set->lazy : NULL, MyLibBase)) x[j++] = x[i];
+			set->n = n + j;
+		}
+	}
+	return !set->lazy;
+}
+
+// Returns the slot of tag x in the table of o, or the free slot it would take.
+static inline ULONG ezxml_qord_slot(struct ezxml_qord *o, ezxml_t x)
+{
+	ULONG i = ((ULONG)(IPTR)x >> 4) * 2654435761UL;
+
+	for(i &= o->mask; o->tag[i] && o->tag[i] != x; i = (i + 1) & o->mask);
+	return i;
+}
+
+// Returns the position of tag x among its siblings, numbering all of them the
+// first time. Returns ~0 if out of memory or x has no parent.
+static ULONG ezxml_qord_num(struct ezxml_qord *o, ezxml_t x)
+{
+	struct LibBase *MyLibBase = o->base;
+	ezxml_t *tag, c;
+	ULONG i, j, k, *num, mask;
+
+	if(o->mask && o->tag[i = ezxml_qord_slot(o, x)]) return o->num[i];
+	if(o->fail || !x->parent) return ~0UL;
+
+	for(k = 0, c = x->parent->child; c; c = c->ordered) k++;
+	if(2 * (o->n + k) > o->mask)    // keep the table at most half full
+	{
+		for(mask = (o->mask) ? o->mask : 63; 2 * (o->n + k) > mask; mask = mask * 2 + 1);
+		tag = o->tag;
+		num = o->num;
+		if(!(o->tag = malloc((mask + 1) * sizeof(ezxml_t))) ||
+		   !(o->num = malloc((mask + 1) * sizeof(ULONG))))
+		{
+			if(o->tag) free(o->tag);
+			o->tag = tag;
+			o->num = num;
+			o->fail = TRUE;
+			return ~0UL;
+		}
+		for(i = 0, j = o->mask, o->mask = mask; tag && i <= j; i++)  // rehash
+			if(tag[i])
+			{
+				k = ezxml_qord_slot(o, tag[i]);
+				o->tag[k] = tag[i];
+				o->num[k] = num[i];
+			}
+		if(tag)
+		{
+			free(tag);
+			free(num);
+		}
+	}
+
+	for(i = 0, c = x->parent->child; c; c = c->ordered, i++)
+	{
+		o->tag[j = ezxml_qord_slot(o, c)] = c;
+		o->num[j] = i;
+		o->n++;
+	}
+	return o->num[ezxml_qord_slot(o, x)];
+}
+
+// Orders query results a and b by their position in the document, NULL
+// standing for the document itself comes first.
+static int ezxml_query_order(const void *a, const void *b)
+{
+	struct ezxml_qord *o = ((struct ezxml_qkey *)a)->o;
+	ezxml_t x = ((struct ezxml_qkey *)a)->x, y = ((struct ezxml_qkey *)b)->x, s, t;
+	ULONG dx = 0, dy = 0;
+
+	if(x == y) return 0;
+	if(!x || !y) return (x) ? 1 : -1;
+	for(s = x; s->parent; s = s->parent) dx++;
+	for(t = y; t->parent; t = t->parent) dy++;
+	for(s = x; dx > dy; dx--) s = s->parent;
+	for(t = y; dy > dx; dy--) t = t->parent;
+	if(s == t) return (s == x) ? -1 : 1;    // one is an ancestor of the other
+
+	while(s->parent != t->parent) s = s->parent, t = t->parent;
+	if(s->off != t->off) return (s->off < t->off) ? -1 : 1;
+	if((dx = ezxml_qord_num(o, s)) != ~0UL && (dy = ezxml_qord_num(o, t)) != ~0UL)
+		return (dx < dy) ? -1 : 1;    // same offset, siblings numbered
+	for(x = s; x && x != t; x = x->ordered);    // t follows s?
+	return (x) ? -1 : 1;
+}
+
+// Puts the n query results x in document order, dropping duplicates. o holds
+// the sibling positions known so far. Returns the number of results left, or
+// ~0 if out of memory.
+static ULONG ezxml_query_sort(ezxml_t *x, ULONG n, struct ezxml_qord *o)
+{
+	struct LibBase *MyLibBase = o->base;
+	struct ezxml_qkey *k, p[2] = {{NULL, o}, {NULL, o}};
+	ULONG i, j;
+
+	for(i = 1; i < n; i++)    // often in order already, as after a single '//'
+	{
+		if(x[i - 1] && x[i] == x[i - 1]->ordered) continue;
+		p[0].x = x[i - 1];
+		p[1].x = x[i];
+		if(ezxml_query_order(p, p + 1) > 0) break;
+	}
+
+	if(i < n)
+	{
+		if(!(k = AllocVec(n * sizeof(struct ezxml_qkey), MEMF_ANY))) return ~0UL;
+		for(i = 0; i < n; i++)
+		{
+			k[i].x = x[i];
+			k[i].o = o;
+		}
+		qsort(k, n, sizeof(struct ezxml_qkey), ezxml_query_order);
+		for(i = 0; i < n; i++) x[i] = k[i].x;
+		FreeVec(k);
+	}
+
+	for(i = j = 1; i < n; i++)
+		if(x[i] != x[j - 1]) x[j++] = x[i];
+	return j;
+}
+
+// Appends the tags step t selects from the tags of cur to nxt, top being the
+// root tag of the document. Returns FALSE if out of memory.
+static BOOL ezxml_query_seq(struct ezxml_qset *cur, ezxml_t top, struct ezxml_step *t, struct ezxml_qset *nxt,
+                            struct LibBase *MyLibBase)
+{
+	struct ezxml_iter it;
+	ezxml_t x;
+	ULONG i;
+
+	for(i = 0; i < cur->n; i++)
+	{
+		x = cur->x[i];
+		if(!ezxml_query_step(x, top, t, nxt, MyLibBase)) return FALSE;
+		if(!t->desc) continue;
+
+		ezxml_iter_init(&it, (x) ? x : top);    // after '//' descendants too
+		if(x) ezxml_iter_next(&it);    // done already
+		while((x = ezxml_iter_next(&it)))
+			if(!ezxml_query_step(x, top, t, nxt, MyLibBase)) return FALSE;
+	}
+	return TRUE;
+}
+
+// Appends a task to step pq. Returns FALSE if out of memory.
+static BOOL ezxml_pquery_add(struct ezxml_pquery *pq, ezxml_t x, BOOL sub, struct LibBase *MyLibBase)
+{
+	struct ezxml_ptask *k;
+	ULONG max;
+
+	if(pq->ntask == pq->tmax)
+	{
+		max = (pq->tmax) ? pq->tmax * 2 : EZXML_QSET;
+		k = (pq->task) ? realloc(pq->task, max * sizeof(struct ezxml_ptask))
+		               : malloc(max * sizeof(struct ezxml_ptask));
+		if(!k) return FALSE;
+		pq->task = k;
+		pq->tmax = max;
+	}
+	pq->task[pq->ntask].x = x;
+	pq->task[pq->ntask++].sub = sub;
+	pq->nsub += sub;
+	return TRUE;
+}
+
+// Appends tasks searching the subtrees of the subtags of x to step pq, of the
+// root tag if x is NULL. Returns FALSE if out of memory.
+static BOOL ezxml_pquery_below(struct ezxml_pquery *pq, ezxml_t x, struct LibBase *MyLibBase)
+{
+	ezxml_t c;
+
+	for(c = (x) ? x->child : pq->top; c; c = (x) ? c->ordered : NULL)
+		if(!ezxml_pquery_add(pq, c, TRUE, MyLibBase)) return FALSE;
+	return TRUE;
+}
+
+// Splits step pq, starting from the tags of cur, into tasks. The subtrees a '//'
+// step searches are split level by level, down to EZXML_PDEPTH levels, until
+// there are want of them. Returns FALSE if out of memory.
+static BOOL ezxml_pquery_split(struct ezxml_pquery *pq, struct ezxml_qset *cur, ULONG want,
+                               struct LibBase *MyLibBase)
+{
+	ULONG i, n, d;
+
+	for(i = 0; i < cur->n; i++)
+	{
+		if(!ezxml_pquery_add(pq, cur->x[i], FALSE, MyLibBase)) return FALSE;
+		if(pq->t->desc && !ezxml_pquery_below(pq, cur->x[i], MyLibBase)) return FALSE;
+	}
+	for(d = 0; pq->t->desc && d < EZXML_PDEPTH && pq->nsub && pq->nsub < want; d++)
+		for(i = 0, n = pq->ntask; i < n; i++)
+			if(pq->task[i].sub)    // the tag alone, then each subtree below it
+			{
+				pq->task[i].sub = FALSE;
+				pq->nsub--;
+				if(!ezxml_pquery_below(pq, pq->task[i].x, MyLibBase)) return FALSE;
+			}
+	return TRUE;
+}
+
+// Evaluates the chunks of step pq no process has taken yet. Only reads the tree.
+static VOID ezxml_pquery_run(struct ezxml_pquery *pq, struct LibBase *MyLibBase)
+{
+	struct ezxml_ptask *k, *e;
+	struct ezxml_qset *set;
+	struct ezxml_iter it;
+	ezxml_t x;
+	ULONG c;
+
+	for(; ;)
+	{
+		ObtainSemaphore(&pq->lock);
+		c = pq->next++;
+		ReleaseSemaphore(&pq->lock);
+		if(c >= pq->nset || pq->fail) return;    // all taken, or no use going on
+
+		set = pq->set + c;
+		set->ro = TRUE;
+		k = pq->task + c * pq->per;
+		e = (c + 1 == pq->nset) ? pq->task + pq->ntask : k + pq->per;
+		for(x = NULL; k < e; k++)
+		{
+			if(!ezxml_query_step(k->x, pq->top, pq->t, set, MyLibBase)) break;
+			if(!k->sub) continue;
+
+			ezxml_iter_init(&it, k->x);
+			ezxml_iter_next(&it);    // done already
+			while((x = ezxml_iter_next(&it)) && ezxml_query_step(x, pq->top, pq->t, set, MyLibBase));
+			if(x) break;
+		}
+		if(k < e) pq->fail = TRUE;
+	}
+}
+
+// Entry of the processes helping to evaluate step pq.
+static VOID ezxml_pquery_proc(struct ezxml_pquery *pq, struct LibBase *MyLibBase)
+{
+	ezxml_pquery_run(pq, MyLibBase);
+
+	Forbid();    // the process is gone before the owner runs on and drops pq
+	pq->running--;
+	Signal(pq->owner, 1UL << pq->sig);
+}
+
+// Appends the tags step t selects from the tags of cur to nxt, like
+// ezxml_query_seq(), with up to nproc processes including the calling one.
+// Returns FALSE if out of memory.
+static BOOL ezxml_query_par(struct ezxml_qset *cur, ezxml_t top, struct ezxml_step *t, struct ezxml_qset *nxt,
+                            ULONG nproc, struct LibBase *MyLibBase)
+{
+	struct ezxml_pquery pq;
+	BOOL ok = FALSE;
+	ULONG i, want = nproc * EZXML_PSPLIT;
+
+	memset(&pq, 0, sizeof(pq));
+	pq.top = top;
+	pq.t = t;
+	pq.sig = -1;
+	if(!ezxml_pquery_split(&pq, cur, want, MyLibBase)) goto done;
+	pq.per = (pq.ntask + want - 1) / want;
+	pq.nset = (pq.ntask + pq.per - 1) / pq.per;
+	if(!(pq.set = malloc(pq.nset * sizeof(struct ezxml_qset)))) goto done;  // cleared
+
+	InitSemaphore(&pq.lock);
+	pq.owner = FindTask(NULL);
+	if((pq.sig = AllocSignal(-1)) >= 0)
+		for(i = 1; i < nproc && i < pq.nset; i++)
+		{
+			Forbid();
+			pq.running++;
+			Permit();
+			if(!CreateNewProcTags(NP_Entry, (IPTR)ezxml_pquery_proc, NP_CodeType, CODETYPE_PPC,
+			                      NP_PPC_Arg1, (IPTR)&pq, NP_PPC_Arg2, (IPTR)MyLibBase,
+			                      NP_Name, (IPTR)"ezxml query", TAG_DONE))
+			{
+				Forbid();
+				pq.running--;
+				Permit();
+				break;
+			}
+		}
+	ezxml_pquery_run(&pq, MyLibBase);    // take part, then wait for the others
+	Forbid();
+	while(pq.running) Wait(1UL << pq.sig);
+	Permit();
+
+	if((ok = !pq.fail))    // merge the chunks in order
+		for(i = 0; i < pq.nset && ok; i++)
+			if((ok = ezxml_qset_room(nxt, pq.set[i].n, MyLibBase)) && pq.set[i].n)
+			{
+				memcpy(nxt->x + nxt->n, pq.set[i].x, pq.set[i].n * sizeof(ezxml_t));
+				nxt->n += pq.set[i].n;
+			}
 
-	if(!xml) return NULL;  // nothing to do
-	if(xml->next) xml->next->sibling = xml->sibling;  // patch sibling list
+done:
+	if(pq.sig >= 0) FreeSignal(pq.sig);
+	for(i = 0; pq.set && i < pq.nset; i++) free(pq.set[i].x);
+	free(pq.set);
+	free(pq.task);
+	if(!ok)    // a value to decode was met, or memory ran short
+	{
+		nxt->n = 0;
+		return ezxml_query_seq(cur, top, t, nxt, MyLibBase);
+	}
+	return TRUE;
+}
 
-	if(xml->parent)    // not root tag
+// Executes query q, see ezxml_query_exec(), with steps over many tags split
+// over up to nproc processes.
+static ULONG ezxml_query_run(ezxml_t xml, ezxml_query_t q, ezxml_t *res, ULONG max, ezxml_query_f cb, APTR data,
+                             ULONG nproc, struct LibBase *MyLibBase)
+{
+	struct ezxml_qset set[2] = {{NULL, 0, 0}, {NULL, 0, 0}}, *cur = set, *nxt = set + 1, *tmp;
+	struct ezxml_qord ord = { NULL, NULL, 0, 0, MyLibBase, FALSE };
+	struct ezxml_step *t;
+	ezxml_t top, x;
+	BOOL ok, nest = FALSE;    // cur may hold tags nested in each other
+	ULONG i, n = 0;
+
+	if(!xml || !q) return 0;
+	for(top = xml; top->parent; top = top->parent);
+	if(!ezxml_qset_add(cur, (q->abs) ? NULL : xml, MyLibBase)) return 0;
+
+	for(t = q->step; t < q->step + q->nstep && cur->n; t++)
 	{
-		cur = xml->parent->child; // find head of subtag list
-		if(cur == xml) xml->parent->child = xml->ordered;  // first subtag
-		else   // not first subtag
-		{
-			while(cur->ordered != xml) cur = cur->ordered;
-			cur->ordered = cur->ordered->ordered; // patch ordered list
+		nxt->n = 0;
+		if(nproc > 1 && (t->desc || cur->n >= EZXML_PMIN)) ok = ezxml_query_par(cur, top, t, nxt, nproc, MyLibBase);
+		else ok = ezxml_query_seq(cur, top, t, nxt, MyLibBase);
+		if(!ok) goto fail;
+
+		nest = nest || t->desc || t->axis == EZXML_Q_UP;
+		if(nest && nxt->n > 1 &&    // restore document order, drop duplicates
+		   (nxt->n = ezxml_query_sort(nxt->x, nxt->n, &ord)) == ~0UL) goto fail;
+		tmp = cur, cur = nxt, nxt = tmp;
+	}
 
-			cur = xml->parent->child; // go back to head of subtag list
-			if(strcmp(cur->name, xml->name))    // not in first sibling list
-			{
-				while(strcmp(cur->sibling->name, xml->name))
-					cur = cur->sibling;
-				if(cur->sibling == xml)    // first of a sibling list
-				{
-					cur->sibling = (xml->next) ? xml->next
-					               : cur->sibling->sibling;
-				}
-				else cur = cur->sibling; // not first of a sibling list
-			}
+	for(i = 0; i < cur->n; i++)
+	{
+		if(!(x = cur->x[i])) continue;    // the document itself
+		if(res && n < max) res[n] = x;
+		n++;
+		if(cb && !cb(x, data)) break;
+	}
 
-			while(cur->next && cur->next != xml) cur = cur->next;
-			if(cur->next) cur->next = cur->next->next;  // patch next list
-		}
+fail:
+	free(set[0].x);
+	free(set[1].x);
+	if(ord.tag)
+	{
+		free(ord.tag);
+		free(ord.num);
 	}
-	xml->ordered = xml->sibling = xml->next = NULL;
-	return xml;
+	return n;
 }
 
-//+ ezxml.library/ezxml_next
-/****** ezxml.library/ezxml_next ***********************************************
+//+ ezxml.library/ezxml_query_exec
+/****** ezxml.library/ezxml_query_exec *****************************************
 * NAME
-*  ezxml_next() - searches for next tag with this same name (V8)
+*  ezxml_query_exec() - executes a compiled query (V9)
 *
 * SYNOPSIS
-*  ezxml_next(xml)
-*  ezxml_t ezxml_next(ezxml_t)
+*  ezxml_query_exec(xml, q, res, max, cb, data)
+*  ULONG ezxml_query_exec(ezxml_t, ezxml_query_t, ezxml_t *, ULONG, ezxml_query_f, APTR)
 *
 * FUNCTION
-*  Searches for the next tag of the same name in the same section and depth.
+*  Finds the tags selected by query q, in document order. Relative queries start
+*  at tag xml, absolute ones at the document xml belongs to.
+*
+*  The first max tags found are stored in array res. Callback cb, if given, is
+*  called for each tag found with the tag and data as arguments. Execution stops
+*  early if it returns 0.
 *
 * INPUTS
 *  xml - ezxml_t structure
+*  q - query returned by ezxml_query_compile()
+*  res - array for the tags found, may be NULL
+*  max - number of entries res has room for
+*  cb - function called for each tag found, may be NULL
+*  data - second argument of cb
 *
 * RESULT
-*	Return a ezxml_t structure of found tag or NULL on failure.
+*	Returns the number of tags found, including those which did not fit in res.
+*	Returns 0 if out of memory.
+*
+* NOTES
+*  Steps without '//' look up tags by name through the same indexes as
+*  ezxml_child() and ezxml_idx(), so a step like "driver[2]" takes constant
+*  time whatever the number of drivers.
 *
 * SEE ALSO
-*  ezxml_child() ezxml_idx()
+*  ezxml_query_compile() ezxml_query_free()
 ********************************************************************************
 *
 */
 //-
-ezxml_t ezxml_next(ezxml_t xml)
+ULONG ezxml_query_exec(ezxml_t xml, ezxml_query_t q, ezxml_t *res, ULONG max, ezxml_query_f cb, APTR data,
+                       struct LibBase *MyLibBase)
 {
-	return ((xml) ? xml->next : NULL);
+	return ezxml_query_run(xml, q, res, max, cb, data, 1, MyLibBase);
 }
 
-//+ ezxml.library/ezxml_name
-/****** ezxml.library/ezxml_name ***********************************************
+//+ ezxml.library/ezxml_query_exec_parallel
+/****** ezxml.library/ezxml_query_exec_parallel ********************************
 * NAME
-*  ezxml_name() - reads name of given tag (V8)
+*  ezxml_query_exec_parallel() - executes a compiled query on many CPUs (V9)
 *
 * SYNOPSIS
-*  ezxml_name(xml)
-*  CONST_STRPTR ezxml_name(ezxml_t)
+*  ezxml_query_exec_parallel(xml, q, res, max, cb, data, nproc)
+*  ULONG ezxml_query_exec_parallel(ezxml_t, ezxml_query_t, ezxml_t *, ULONG, ezxml_query_f, APTR, ULONG)
 *
 * FUNCTION
-*  Reads name of given tag from its ezxml_t structure.
+*  Works like ezxml_query_exec(), but splits the work of steps starting from
+*  many tags, and of '//' steps, over up to nproc processes, the calling one
+*  included. A '//' step splits the subtrees it searches a few levels down into
+*  chunks, which the processes take from a shared queue until none are left.
+*  The results of the chunks are merged in document order.
 *
 * INPUTS
 *  xml - ezxml_t structure
+*  q - query returned by ezxml_query_compile()
+*  res - array for the tags found, may be NULL
+*  max - number of entries res has room for
+*  cb - function called for each tag found, may be NULL
+*  data - second argument of cb
+*  nproc - number of processes to use, 0 and 1 evaluate like ezxml_query_exec()
 *
 * RESULT
-*	Return a pointer to string contains name of given tag.
+*	Returns the number of tags found, including those which did not fit in res.
+*	Returns 0 if out of memory.
 *
 * NOTES
-*  Return NULL on failure.
+*  The helper processes only read the tree: they neither build name indexes nor
+*  decode values. A step meeting values a lazy parse left to decode is evaluated
+*  again by the calling process alone. cb is only called by the calling process,
+*  once all steps are done.
+*
+*  The document must not be changed while the query runs.
 *
 * SEE ALSO
-*  ezxml_txt()
+*  ezxml_query_exec() ezxml_query_compile()
 ********************************************************************************
 *
 */
 //-
-STRPTR ezxml_name(ezxml_t xml)
+ULONG ezxml_query_exec_parallel(ezxml_t xml, ezxml_query_t q, ezxml_t *res, ULONG max, ezxml_query_f cb, APTR data,
+                                ULONG nproc, struct LibBase *MyLibBase)
 {
-	return ((xml) ? xml->name : NULL);
+	return ezxml_query_run(xml, q, res, max, cb, data, nproc, MyLibBase);
 }
 
-//+ ezxml.library/ezxml_txt
-/****** ezxml.library/ezxml_txt ***********************************************
+//+ ezxml.library/ezxml_query_free
+/****** ezxml.library/ezxml_query_free *****************************************
 * NAME
-*  ezxml_txt() - reads contents of given tag (V8)
+*  ezxml_query_free() - frees a compiled query (V9)
 *
 * SYNOPSIS
-*  ezxml_txt(xml)
-*  CONST_STRPTR ezxml_txt(ezxml_t)
+*  ezxml_query_free(q)
+*  VOID ezxml_query_free(ezxml_query_t)
 *
 * FUNCTION
-*  Reads contents of given tag from its ezxml_t structure.
+*  Frees the memory of a query compiled by ezxml_query_compile().
 *
 * INPUTS
-*  xml - ezxml_t structure
-*
-* RESULT
-*	Return a pointer to string contains content of given tag.
-*
-* NOTES
-*  Return empty string ("") on failure.
+*  q - query to free, may be NULL
 *
 * SEE ALSO
-*  ezxml_name()
+*  ezxml_query_compile()
 ********************************************************************************
 *
 */
 //-
-STRPTR ezxml_txt(ezxml_t xml)
+VOID ezxml_query_free(ezxml_query_t q, struct LibBase *MyLibBase)
 {
-	return ((xml) ? xml->txt : "");
+	if(q) free(q);
 }
 
-//+ ezxml.library/ezxml_new_d
-/****** ezxml.library/ezxml_new_d **********************************************
+// Marks the indexes of the document holding xml stale if a change may affect
+// them: of the content of a tag named name for EZXML_Q_TXT, of attribute name
+// for EZXML_Q_ATTR, of the structure of the tree for 0.
+static VOID ezxml_index_touch(ezxml_t xml, UBYTE type, CONST_STRPTR name)
+{
+	struct ezxml_index *ix;
+
+	if(EZXML_DOC(xml)->lent)    // the tag may be part of another document
+		for(; xml->parent; xml = xml->parent);
+	for(ix = EZXML_DOC(xml)->index; ix; ix = ix->next)
+	{
+		if(!type || ix->pred) ix->stale = TRUE;
+		else if(type == EZXML_Q_ATTR) ix->stale |= (ix->type == EZXML_Q_ATTR && !strcmp(ix->name, name));
+		else ix->stale |= (ix->type == EZXML_Q_TXT || (ix->type == EZXML_Q_SUB && !strcmp(ix->name, name)));
+	}
+}
+
+// Adds tag xml to index data if it has a key, called by ezxml_query_exec().
+// Returns 0 and leaves the index stale if out of memory.
+static LONG ezxml_index_add(ezxml_t xml, APTR data)
+{
+	struct ezxml_index *ix = data;
+	struct LibBase *MyLibBase = ix->root->base;
+	struct ezxml_ient *e;
+	CONST_STRPTR key;
+	ezxml_t c;
+	ULONG max;
+
+	if(ix->type == EZXML_Q_ATTR) key = ezxml_attr(xml, ix->name);
+	else if(ix->type == EZXML_Q_TXT) key = ezxml_txt(xml);
+	else key = ((c = ezxml_name_get(xml, ix->name))) ? ezxml_txt(c) : NULL;
+	if(!key) return TRUE;    // tag has no key, not indexed
+
+	if(ix->n == ix->max)
+	{
+		max = (ix->max) ? ix->max * 2 : EZXML_QSET;
+		e = (ix->ent) ? realloc(ix->ent, max * sizeof(struct ezxml_ient))
+		    : malloc(max * sizeof(struct ezxml_ient));
+		if(!e)
+		{
+			ix->stale = TRUE;
+			return FALSE;
+		}
+		ix->ent = e;
+		ix->max = max;
+	}
+	e = ix->ent + ix->n++;
+	e->key = key;
+	e->xml = xml;
+	e->hash = ezxml_hash(key, strlen(key));
+	return TRUE;
+}
+
+// Orders entries of a value index by key, entries of equal keys by document
+// order.
+static int ezxml_index_order(const void *a, const void *b)
+{
+	struct ezxml_ient *x = *(struct ezxml_ient **)a, *y = *(struct ezxml_ient **)b;
+	int c = strcmp(x->key, y->key);
+
+	return (c) ? c : (x < y) ? -1 : (x > y);
+}
+
+// Builds the list of entries of index ix ordered by key. Returns FALSE if out
+// of memory.
+static BOOL ezxml_index_sort(struct ezxml_index *ix, struct LibBase *MyLibBase)
+{
+	ULONG i;
+
+	if(!(ix->sort = malloc((ix->n + 1) * sizeof(struct ezxml_ient *)))) return FALSE;
+	for(i = 0; i < ix->n; i++) ix->sort[i] = ix->ent + i;
+	qsort(ix->sort, ix->n, sizeof(struct ezxml_ient *), ezxml_index_order);
+	ix->sorted = TRUE;
+	return TRUE;
+}
+
+// Brings index ix up to date with its document, ordering its entries by key
+// too if sort is TRUE. Returns FALSE if out of memory.
+static BOOL ezxml_index_ready(struct ezxml_index *ix, BOOL sort, struct LibBase *MyLibBase)
+{
+	struct ezxml_ient *e, **b;
+	ULONG size;
+
+	if(ix->stale)    // rebuild
+	{
+		if(ix->sort) free(ix->sort);
+		if(ix->tab) free(ix->tab);
+		ix->sort = ix->tab = NULL;
+		ix->n = ix->stale = 0;
+
+		ezxml_query_exec(&ix->root->xml, ix->q, NULL, 0, ezxml_index_add, ix, MyLibBase);
+		for(size = EZXML_QSET; size < ix->n; size *= 2);
+		if(ix->stale || !(ix->tab = malloc(size * sizeof(struct ezxml_ient *))))
+		{
+			ix->stale = TRUE;
+			return FALSE;
+		}
+		ix->mask = size - 1;
+
+		for(e = ix->ent + ix->n; e-- != ix->ent; )    // chains in document order
+		{
+			b = &ix->tab[e->hash & ix->mask];
+			e->next = *b;
+			*b = e;
+		}
+	}
+	if((sort || ix->sorted) && !ix->sort && !ezxml_index_sort(ix, MyLibBase)) return FALSE;
+	return TRUE;
+}
+
+// Stores tag xml found by a lookup in the n-th entry of res if it has room.
+static inline VOID ezxml_index_res(ezxml_t *res, ULONG max, ULONG n, ezxml_t xml)
+{
+	if(res && n < max) res[n] = xml;
+}
+
+// Unlinks index ix from its document and frees it.
+static VOID ezxml_index_drop(struct ezxml_index *ix, struct LibBase *MyLibBase)
+{
+	struct ezxml_index **p;
+
+	for(p = &ix->root->index; *p != ix; p = &(*p)->next);
+	*p = ix->next;
+	ezxml_query_free(ix->q, MyLibBase);
+	if(ix->ent) free(ix->ent);
+	if(ix->tab) free(ix->tab);
+	if(ix->sort) free(ix->sort);
+	free(ix);
+}
+
+//+ ezxml.library/ezxml_index_create
+/****** ezxml.library/ezxml_index_create ***************************************
 * NAME
-*  ezxml_new_d() - wrapper for ezxml_new that duplicate name string (V8)
+*  ezxml_index_create() - creates a value index of a document (V9)
 *
 * SYNOPSIS
-*  ezxml_new_d(name);
-*  ezxml_t ezxml_new_d(CONST_STRPTR);
+*  ezxml_index_create(xml, path, key, flags)
+*  ezxml_index_t ezxml_index_create(ezxml_t, CONST_STRPTR, CONST_STRPTR, ULONG)
 *
 * FUNCTION
-*  Creates a new ezxml_t structure with given root tag name. Name string will be duplicated.
+*  Indexes the tags selected by path by a key, to look them up by its value
+*  with ezxml_index_get() or by a range of values with ezxml_index_range() and
+*  ezxml_index_prefix().
+*
+*  The key is "@name" for the value of attribute name, "name" for the character
+*  content of the first subtag called name or "." for the character content of
+*  the tag itself. Tags without the attribute or subtag are left out.
 *
 * INPUTS
-*  name - name of the root tag
+*  xml - any tag of the document
+*  path - path expression as taken by ezxml_query_compile(), relative paths
+*         start at the root tag of the document
+*  key - key specification
+*  flags - EZXML_INDEX_SORTED to order the keys right away instead of on the
+*          first range scan
 *
 * RESULT
-*  Returns new ezxml_t structure with given root tag name.
+*	Returns the index, NULL on a syntax error or if out of memory.
 *
 * NOTES
-*  Name will be copied, so you don't have to pay attention for not freeing it too early.
+*  The index belongs to the document and is freed with it by ezxml_free().
+*  Changes made by ezxml_set_attr(), ezxml_set_txt(), ezxml_insert(),
+*  ezxml_cut() and the functions built on them mark the index stale when they
+*  may affect it. A stale index is rebuilt by the next lookup.
+*
+* EXAMPLE
+*  ix = ezxml_index_create(doc, "//item", "@id", 0);
+*  if(ezxml_index_get(ix, "42", &item, 1)) ...
 *
 * SEE ALSO
-*  ezxml_free() ezxml_new()
+*  ezxml_index_get() ezxml_index_range() ezxml_index_free() ezxml_query_compile()
 ********************************************************************************
 *
 */
 //-
-ezxml_t ezxml_new_d(CONST_STRPTR name, struct LibBase *MyLibBase)
+ezxml_index_t ezxml_index_create(ezxml_t xml, CONST_STRPTR path, CONST_STRPTR key, ULONG flags,
+                                 struct LibBase *MyLibBase)
 {
-	return ezxml_set_flag(ezxml_new(strdup(name), MyLibBase), EZXML_NAMEM);
+	struct ezxml_index *ix;
+	struct ezxml_step *t;
+	ezxml_root_t root;
+
+	if(!xml || !path || !key || !*key || !strcmp(key, "@")) return NULL;
+	for(; xml->parent; xml = xml->parent);
+	root = EZXML_DOC(xml);
+
+	if(!(ix = malloc(sizeof(struct ezxml_index) + strlen(key) + 1))) return NULL;
+	ix->name = strcpy((STRPTR)(ix + 1), (*key == '@') ? key + 1 : key);
+	if(*key == '@') ix->type = EZXML_Q_ATTR;
+	else if(!strcmp(key, ".") || !strcmp(key, "text()")) ix->type = EZXML_Q_TXT;
+	else ix->type = EZXML_Q_SUB;
+
+	if(!(ix->q = ezxml_query_compile(path, MyLibBase)))
+	{
+		free(ix);
+		return NULL;
+	}
+	for(t = ix->q->step; t < ix->q->step + ix->q->nstep; t++) ix->pred |= (t->npred > 0);
+	ix->root = root;
+	ix->next = root->index;
+	root->index = ix;
+
+	ix->stale = TRUE;
+	if(!ezxml_index_ready(ix, flags & EZXML_INDEX_SORTED, MyLibBase))
+	{
+		ezxml_index_drop(ix, MyLibBase);
+		return NULL;
+	}
+	return ix;
 }
-//+ ezxml.library/ezxml_add_child_d
-/****** ezxml.library/ezxml_add_child_d *****************************************
+
+//+ ezxml.library/ezxml_index_get
+/****** ezxml.library/ezxml_index_get ******************************************
 * NAME
-*  ezxml_add_child_d() - wrapper for ezxml_add_child that duplicate name string (V8)
+*  ezxml_index_get() - looks up tags by key (V9)
 *
 * SYNOPSIS
-*  ezxml_add_child_d(xml, name, off);
-*  ezxml_t ezxml_add_child_d(ezxml_t, CONST_STRPTR, ULONG);
+*  ezxml_index_get(ix, key, res, max)
+*  ULONG ezxml_index_get(ezxml_index_t, CONST_STRPTR, ezxml_t *, ULONG)
 *
 * FUNCTION
-*  Adds a child to given tag with specified name. Off is the offset of the child tag
-*  relative to the start of the parent tag's character content.
+*  Finds the tags of index ix whose key equals key. The first max of them, in
+*  document order, are stored in array res.
 *
 * INPUTS
-*  xml  - ezxml_t structure of parents' tag
-*  name - name of the child tag
-*  off  - offset of the child tag relative to the start of the parent tag's character content
+*  ix - index returned by ezxml_index_create()
+*  key - value to look for
+*  res - array for the tags found, may be NULL
+*  max - number of entries res has room for
 *
 * RESULT
-*  Returns the child tag.
-*
-* NOTES
-*  Name will be copied, so you don't have to pay attention for not freeing it too early.
+*	Returns the number of tags found, including those which did not fit in res.
 *
 * SEE ALSO
-*  ezxml_free() ezxml_new() ezxml_add_child()
+*  ezxml_index_create() ezxml_index_range()
 ********************************************************************************
 *
 */
 //-
-ezxml_t ezxml_add_child_d(ezxml_t xml, CONST_STRPTR name, ULONG off, struct LibBase *MyLibBase)
+ULONG ezxml_index_get(ezxml_index_t ix, CONST_STRPTR key, ezxml_t *res, ULONG max, struct LibBase *MyLibBase)
 {
-	return ezxml_set_flag(ezxml_add_child(xml, strdup(name), off, MyLibBase), EZXML_NAMEM);
+	struct ezxml_ient *e;
+	ULONG h, n = 0;
+
+	if(!ix || !key || !ezxml_index_ready(ix, FALSE, MyLibBase)) return 0;
+	h = ezxml_hash(key, strlen(key));
+	for(e = ix->tab[h & ix->mask]; e; e = e->next)
+		if(e->hash == h && !strcmp(e->key, key)) ezxml_index_res(res, max, n++, e->xml);
+	return n;
 }
-//+ ezxml.library/ezxml_set_text_d
-/****** ezxml.library/ezxml_set_text_d ********************************************
+
+// Returns the position of the first entry of index ix, ordered by key, whose
+// key is not less than key.
+static ULONG ezxml_index_bound(struct ezxml_index *ix, CONST_STRPTR key)
+{
+	ULONG lo = 0, hi = ix->n, m;
+
+	while(lo < hi)
+	{
+		m = (lo + hi) / 2;
+		if(strcmp(ix->sort[m]->key, key) < 0) lo = m + 1;
+		else hi = m;
+	}
+	return lo;
+}
+
+//+ ezxml.library/ezxml_index_range
+/****** ezxml.library/ezxml_index_range ****************************************
 * NAME
-*  ezxml_set_text_d() - wrapper for ezxml_set_text() that duplicate content string (V8)
+*  ezxml_index_range() - looks up tags by a range of keys (V9)
 *
 * SYNOPSIS
-*  ezxml_set_txt_d(xml, txt);
-*  ezxml_t ezxml_set_txt_d(ezxml_t, CONST_STRPTR);
+*  ezxml_index_range(ix, lo, hi, res, max)
+*  ULONG ezxml_index_range(ezxml_index_t, CONST_STRPTR, CONST_STRPTR, ezxml_t *, ULONG)
 *
 * FUNCTION
-*  Sets the content of the given tag with copy the txt string.
+*  Finds the tags of index ix whose key is not less than lo and less than hi.
+*  The first max of them, ordered by key, are stored in array res.
 *
 * INPUTS
-*  xml - ezxml_t structure of tag
-*  txt - contents to be placed in tag
+*  ix - index returned by ezxml_index_create()
+*  lo - lowest key, NULL for no lower bound
+*  hi - key following the highest one, NULL for no upper bound
+*  res - array for the tags found, may be NULL
+*  max - number of entries res has room for
 *
 * RESULT
-*  Returns the tag.
+*	Returns the number of tags found, including those which did not fit in res.
 *
 * NOTES
-*  Txt will be copied, so you don't have to pay attention for not freeing it too early.
+*  Keys are compared as strings, byte by byte.
 *
 * SEE ALSO
-*  ezxml_free() ezxml_set_text() ezxml_set_attr() ezxml_set_flag()
+*  ezxml_index_create() ezxml_index_prefix() ezxml_index_get()
 ********************************************************************************
 *
 */
 //-
-ezxml_t ezxml_set_txt_d(ezxml_t xml, CONST_STRPTR txt, struct LibBase *MyLibBase)
+ULONG ezxml_index_range(ezxml_index_t ix, CONST_STRPTR lo, CONST_STRPTR hi, ezxml_t *res, ULONG max,
+                        struct LibBase *MyLibBase)
 {
-	return ezxml_set_flag(ezxml_set_txt(xml, strdup(txt), MyLibBase), EZXML_TXTM);
+	ULONG i, n = 0;
+
+	if(!ix || !ezxml_index_ready(ix, TRUE, MyLibBase)) return 0;
+	for(i = (lo) ? ezxml_index_bound(ix, lo) : 0;
+	        i < ix->n && (!hi || strcmp(ix->sort[i]->key, hi) < 0); i++)
+		ezxml_index_res(res, max, n++, ix->sort[i]->xml);
+	return n;
 }
-//+ ezxml.library/ezxml_set_attr_d
-/****** ezxml.library/ezxml_set_attr_d *****************************************
+
+//+ ezxml.library/ezxml_index_prefix
+/****** ezxml.library/ezxml_index_prefix ***************************************
 * NAME
-*  ezxml_set_attr_d() - wrapper for ezxml_set_attr() that duplicate name and value (V8)
+*  ezxml_index_prefix() - looks up tags by the start of their keys (V9)
 *
 * SYNOPSIS
-*  ezxml_set_attr_d(xml, name, value);
-*  ezxml_t ezxml_set_attr_d(ezxml_t, CONST_STRPTR, CONST_STRPTR);
+*  ezxml_index_prefix(ix, prefix, res, max)
+*  ULONG ezxml_index_prefix(ezxml_index_t, CONST_STRPTR, ezxml_t *, ULONG)
 *
 * FUNCTION
-*  Sets the given tag attribute or creates a new attribute if not found.
-*  Name and value will be duplicated.
+*  Finds the tags of index ix whose key starts with prefix. The first max of
+*  them, ordered by key, are stored in array res.
 *
 * INPUTS
-*  xml - ezxml_t structure of tag
-*  name - name of attribute
-*  value - value of attribute
+*  ix - index returned by ezxml_index_create()
+*  prefix - start of the keys
+*  res - array for the tags found, may be NULL
+*  max - number of entries res has room for
 *
 * RESULT
-*  Returns the tag given.
-*
-* NOTES
-*  Value cannot be NULL, so for deleting attribute you have to use ezxml_set_attr().
+*	Returns the number of tags found, including those which did not fit in res.
 *
 * SEE ALSO
-*  ezxml_free() ezxml_set_text() ezxml_set_attr() ezxml_set_flag()
+*  ezxml_index_create() ezxml_index_range()
 ********************************************************************************
 *
 */
 //-
-ezxml_t ezxml_set_attr_d(ezxml_t xml, CONST_STRPTR name, CONST_STRPTR value, struct LibBase *MyLibBase)
+ULONG ezxml_index_prefix(ezxml_index_t ix, CONST_STRPTR prefix, ezxml_t *res, ULONG max,
+                         struct LibBase *MyLibBase)
 {
-	return ezxml_set_attr(ezxml_set_flag(xml, EZXML_DUP), strdup(name), strdup(value), MyLibBase);
+	ULONG i, l, n = 0;
+
+	if(!ix || !prefix || !ezxml_index_ready(ix, TRUE, MyLibBase)) return 0;
+	l = strlen(prefix);
+	for(i = ezxml_index_bound(ix, prefix); i < ix->n && !strncmp(ix->sort[i]->key, prefix, l); i++)
+		ezxml_index_res(res, max, n++, ix->sort[i]->xml);
+	return n;
 }
-//+ ezxml.library/ezxml_move
-/****** ezxml.library/ezxml_move **********************************************
+
+//+ ezxml.library/ezxml_index_free
+/****** ezxml.library/ezxml_index_free *****************************************
 * NAME
-*  ezxml_move() - moves an existing tag (V8)
+*  ezxml_index_free() - frees a value index (V9)
 *
 * SYNOPSIS
-*  ezxml_move(xml, dest, off);
-*  ezxml_t ezxml_move(ezxml_t, ezxml_t, ULONG);
+*  ezxml_index_free(ix)
+*  VOID ezxml_index_free(ezxml_index_t)
 *
 * FUNCTION
-*  Moves an existing tag to become a subtag of dest tag at the
-*  given offset from the start of dest's character content.
+*  Frees an index before its document is freed. Indexes left are freed by
+*  ezxml_free() together with their document.
 *
 * INPUTS
-*  xml  - source ezxml_t structure
-*  dest - destination ezxml_structure
-*  off  - offset
-*
-* RESULT
-*  Returns the moved tag.
+*  ix - index to free, may be NULL
 *
 * SEE ALSO
-*  ezxml_insert()
+*  ezxml_index_create() ezxml_free()
 ********************************************************************************
 *
 */
 //-
-ezxml_t ezxml_move(ezxml_t xml, ezxml_t dest, ULONG off)
+VOID ezxml_index_free(ezxml_index_t ix, struct LibBase *MyLibBase)
 {
-	return ezxml_insert(ezxml_cut(xml), dest, off);
+	if(ix) ezxml_index_drop(ix, MyLibBase);
 }
-//+ ezxml.library/ezxml_remove
-/****** ezxml.library/ezxml_remove **********************************************
+
+// Returns the steps of query q that subtags of tag xml may match, given those
+// that xml itself could match as bits of mask m. Sets *hit if xml matches the
+// last step.
+static ULONG ezxml_foreach_match(struct ezxml_query *q, ezxml_t xml, ULONG m, BOOL *hit,
+                                 struct LibBase *MyLibBase)
+{
+	struct ezxml_step *t;
+	struct ezxml_pred *p;
+	ULONG i, n = 0;
+
+	for(i = 0; i < q->nstep; i++)
+	{
+		if(!(m & (1UL << i))) continue;
+		t = q->step + i;
+		if(t->desc) n |= 1UL << i;    // deeper tags may match it still
+		if(t->name && strcmp(t->name, xml->name)) continue;
+		for(p = t->pred; p < t->pred + t->npred && ezxml_query_test(xml, p, NULL, MyLibBase); p++);
+		if(p < t->pred + t->npred) continue;
+
+		if(i + 1 == q->nstep) *hit = TRUE;
+		else n |= 1UL << (i + 1);
+	}
+	return n;
+}
+
+//+ ezxml.library/ezxml_foreach
+/****** ezxml.library/ezxml_foreach ********************************************
 * NAME
-*  ezxml_remove() - wrapper for ezxml_cut() and ezxml_free() (V8)
+*  ezxml_foreach() - calls a function for the tags matching a path (V9)
 *
 * SYNOPSIS
-*  ezxml_remove(xml);
-*  VOID ezxml_move(ezxml_t);
+*  ezxml_foreach(xml, path, fn, data)
+*  ULONG ezxml_foreach(ezxml_t, CONST_STRPTR, ezxml_query_f, APTR)
 *
 * FUNCTION
-*  Removes a tag along with its subtag with freeing the memory.
+*  Walks through the subtags of xml in document order and calls fn for those
+*  matching path, with the tag and data as arguments. The walk stops early if
+*  fn returns 0.
+*
+*  The path takes the syntax of ezxml_query_compile() but for '.', '..' and
+*  positional predicates, e.g. "a/b//c" or "//item[@id]". Subtrees which can
+*  not hold a match are not walked through.
 *
 * INPUTS
-*  xml - ezxml_t structure do be removed
+*  xml - ezxml_t structure
+*  path - path expression, relative to xml unless it starts with '/'
+*  fn - function to call
+*  data - second argument of fn
+*
+* RESULT
+*	Returns the number of tags fn was called for, 0 for an invalid path. The
+*	walk stops early if out of memory.
+*
+* NOTES
+*  Unlike ezxml_query_exec() it builds no lists of tags, a path up to 32 steps
+*  long takes memory for a word per level of the tree only.
 *
 * SEE ALSO
-*  ezxml_free() ezxml_cut()
+*  ezxml_iter_init() ezxml_query_exec()
 ********************************************************************************
 *
 */
 //-
-void ezxml_remove(ezxml_t xml, struct LibBase *MyLibBase)
+ULONG ezxml_foreach(ezxml_t xml, CONST_STRPTR path, ezxml_query_f fn, APTR data, struct LibBase *MyLibBase)
 {
-	ezxml_free(ezxml_cut(xml), MyLibBase);
-}
\ No newline at end of file
+	struct ezxml_query *q;
+	struct ezxml_step *t;
+	struct ezxml_pred *p;
+	struct ezxml_iter it;
+	ULONG *m, *tmp, max = EZXML_QSET, d, o, n = 0;
+	BOOL hit;
+
+	if(!xml || !fn || !(q = ezxml_query_compile(path, MyLibBase))) return 0;
+	for(t = q->step; t < q->step + q->nstep && t->axis == EZXML_Q_CHILD; t++)
+	{
+		for(p = t->pred; p < t->pred + t->npred && p->type != EZXML_Q_POS && p->type != EZXML_Q_LAST; p++);
+		if(p < t->pred + t->npred) break;
+	}
+	if(t < q->step + q->nstep || q->nstep > 32 || !(m = malloc(max * sizeof(ULONG))))
+	{
+		ezxml_query_free(q, MyLibBase);
+		return 0;    // unsupported step or predicate
+	}
+
+	if((o = q->abs)) for(; xml->parent; xml = xml->parent);    // the document is above the root tag
+	m[0] = 1;    // the first step applies to the subtags of the context
+	ezxml_iter_init(&it, xml);
+	while((xml = ezxml_iter_next(&it)))
+	{
+		if(!(d = it.depth + o)) continue;    // context of a relative path
+		if(d == max)
+		{
+			if(!(tmp = realloc(m, (max *= 2) * sizeof(ULONG)))) break;
+			m = tmp;
+		}
+
+		hit = FALSE;
+		if(!(m[d] = ezxml_foreach_match(q, xml, m[d - 1], &hit, MyLibBase)))
+			ezxml_iter_skip_subtree(&it);    // prune
+		if(hit)
+		{
+			n++;
+			if(!fn(xml, data)) break;
+		}
+	}
+
+	free(m);
+	ezxml_query_free(q, MyLibBase);
+	return n;
+}
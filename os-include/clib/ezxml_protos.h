@@ -48,6 +48,8 @@ ezxml_t ezxml_parse_fd(BPTR fd);
 
 ezxml_t ezxml_parse_file(CONST_STRPTR file);
 
+ezxml_t ezxml_parse_fp(BPTR fp);
+
 ezxml_t ezxml_child(ezxml_t xml, CONST_STRPTR name);
 
 ezxml_t ezxml_next(ezxml_t xml);
@@ -96,6 +98,72 @@ ezxml_t ezxml_move(ezxml_t xml, ezxml_t dest, ULONG off);
 
 VOID ezxml_remove(ezxml_t xml);
 
+ezxml_parser_t ezxml_parser_new(VOID);
+
+LONG ezxml_parse_chunk(ezxml_parser_t parser, CONST_APTR buf, ULONG len);
+
+ezxml_t ezxml_parse_finish(ezxml_parser_t parser);
+
+ezxml_reader_t ezxml_reader_open(STRPTR s, ULONG len);
+
+ezxml_event_t ezxml_reader_next(ezxml_reader_t reader);
+
+CONST_STRPTR ezxml_reader_error(ezxml_reader_t reader);
+
+VOID ezxml_reader_close(ezxml_reader_t reader);
+
+ezxml_t ezxml_parse_str_flags(STRPTR, ULONG len, ULONG flags);
+
+CONST_STRPTR ezxml_sym(ezxml_t xml, CONST_STRPTR name);
+
+ezxml_t ezxml_child_sym(ezxml_t xml, CONST_STRPTR sym);
+
+CONST_STRPTR ezxml_attr_sym(ezxml_t xml, CONST_STRPTR sym);
+
+ULONG ezxml_count(ezxml_t xml);
+
+ezxml_query_t ezxml_query_compile(CONST_STRPTR path);
+
+ULONG ezxml_query_exec(ezxml_t xml, ezxml_query_t q, ezxml_t *res, ULONG max, ezxml_query_f cb, APTR data);
+
+VOID ezxml_query_free(ezxml_query_t q);
+
+ezxml_index_t ezxml_index_create(ezxml_t xml, CONST_STRPTR path, CONST_STRPTR key, ULONG flags);
+
+ULONG ezxml_index_get(ezxml_index_t ix, CONST_STRPTR key, ezxml_t *res, ULONG max);
+
+ULONG ezxml_index_range(ezxml_index_t ix, CONST_STRPTR lo, CONST_STRPTR hi, ezxml_t *res, ULONG max);
+
+ULONG ezxml_index_prefix(ezxml_index_t ix, CONST_STRPTR prefix, ezxml_t *res, ULONG max);
+
+VOID ezxml_index_free(ezxml_index_t ix);
+
+VOID ezxml_iter_init(struct ezxml_iter *it, ezxml_t xml);
+
+ezxml_t ezxml_iter_next(struct ezxml_iter *it);
+
+VOID ezxml_iter_skip_subtree(struct ezxml_iter *it);
+
+ULONG ezxml_foreach(ezxml_t xml, CONST_STRPTR path, ezxml_query_f fn, APTR data);
+
+ULONG ezxml_attrs_bind(ezxml_t xml, CONST_STRPTR *names, CONST_STRPTR *values);
+
+ULONG ezxml_children_bind(ezxml_t xml, CONST_STRPTR *names, ezxml_t *nodes);
+
+LONG ezxml_src_pos(ezxml_t xml, ULONG *off, ULONG *len);
+
+LONG ezxml_line_col(ezxml_t xml, ULONG *line, ULONG *col);
+
+ULONG ezxml_query_exec_parallel(ezxml_t xml, ezxml_query_t q, ezxml_t *res, ULONG max, ezxml_query_f cb, APTR data, ULONG nproc);
+
+ezxml_t ezxml_parse_fd_overlap(BPTR fd);
+
+LONG ezxml_toxml_gz(ezxml_t xml, BPTR fd);
+
+LONG ezxml_toxml_fd(ezxml_t xml, BPTR fd);
+
+LONG ezxml_toxml_cb(ezxml_t xml, ezxml_write_f fn, APTR data);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
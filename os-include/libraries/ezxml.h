@@ -31,6 +31,13 @@ extern "C" {
 #endif
 
 typedef struct ezxml *ezxml_t;
+typedef struct ezxml_parser *ezxml_parser_t; /* opaque push parser context */
+typedef struct ezxml_reader *ezxml_reader_t; /* opaque reader context      */
+typedef struct ezxml_event *ezxml_event_t;
+typedef struct ezxml_query *ezxml_query_t;   /* opaque compiled query      */
+typedef LONG (*ezxml_query_f)(ezxml_t xml, APTR data); /* query callback, 0 stops */
+typedef struct ezxml_index *ezxml_index_t;   /* opaque value index         */
+typedef LONG (*ezxml_write_f)(CONST_APTR buf, ULONG len, APTR data); /* output callback, 0 stops */
 
 struct ezxml {
     STRPTR name;      /* tag name 															  */
@@ -45,6 +52,36 @@ struct ezxml {
     SHORT flags;      /* additional information											  */
 };
 
+/* flags of ezxml_parse_str_flags() */
+#define EZXML_PARSE_LAZY 0x01 /* decode text and attribute values on first access */
+#define EZXML_PARSE_LINES 0x02 /* no effect, line breaks are always indexed up front */
+
+/* flags of ezxml_index_create() */
+#define EZXML_INDEX_SORTED 0x01 /* order keys right away, not on the first range scan */
+
+/* event types reported by ezxml_reader_next() */
+#define EZXML_EV_START   1 /* start tag                         */
+#define EZXML_EV_END     2 /* end tag                           */
+#define EZXML_EV_TEXT    3 /* character content or cdata        */
+#define EZXML_EV_PI      4 /* processing instruction            */
+#define EZXML_EV_COMMENT 5 /* comment                           */
+
+struct ezxml_iter {
+    ezxml_t top;      /* tag the walk started at, NULL when it is done          */
+    ezxml_t cur;      /* tag returned last, NULL before the first step          */
+    ULONG depth;      /* number of tags between cur and top                     */
+    LONG skip;        /* next step goes past the subtags of cur                 */
+};
+
+struct ezxml_event {
+    LONG type;        /* one of EZXML_EV_*                                      */
+    STRPTR name;      /* tag name or pi target, NULL for other events           */
+    STRPTR *attr;     /* start tag attributes { name, value, ... NULL }         */
+    STRPTR txt;       /* text, comment or pi, empty string for other events     */
+    ULONG len;        /* length of txt                                          */
+    ULONG depth;      /* number of tags enclosing the event                     */
+};
+
 #ifdef __cplusplus
 }
 #endif